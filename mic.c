@@ -37,54 +37,256 @@
 
 #define MIC_STATUS_ACTIVE		0x8000
 
+// gain, rate and size bits together; they index __MICStatusTable
+#define MIC_STATUS_PARAMS		0x7c00
+#define MIC_STATUS_PARAMS_SHIFT	10
+#define MIC_STATUS_INDEX(status) \
+	(((status) & MIC_STATUS_PARAMS) >> MIC_STATUS_PARAMS_SHIFT)
 
-struct MICControlBlock
+#define MIC_STATUS_SIZE			(MIC_STATUS_64BYTES | MIC_STATUS_128BYTES)
+#define MIC_STATUS_RATE			(MIC_STATUS_22050Hz | MIC_STATUS_44100Hz)
+#define MIC_STATUS_OUT			0x000f
+
+// Passed to __MICFindStatus for fields that should stay as they are
+#define MIC_PARAM_KEEP			-1
+
+// Requests waiting to be applied from the alarm or EXI interrupt path
+#define MIC_QUEUE_DEPTH			8
+
+#define MIC_COMMAND_START		0x0001	// reset the ring and arm the watchdog first
+#define MIC_COMMAND_RESET		0x0002	// reset the device instead of writing status
+
+// Discontinuity records held until MICGetDiscontinuity collects them
+#define MIC_DISCONT_DEPTH		8
+
+// Most hw blocks of silence gap fill writes for one discontinuity, as it
+// runs with interrupts off
+#define MIC_GAPFILL_BLOCKS		4
+
+// Block listeners added with MICAddTxListener, called after tx_callback
+#define MIC_TX_LISTENERS		8
+
+// MICGetSamples callers told apart for ring_overruns, see __MICNoteRead
+#define MIC_READERS			4
+
+// The published cursor word: the top sample index in the low bits, a
+// generation that changes with every ring reconfiguration above them
+#define MIC_CURSOR_INDEX_BITS	20
+#define MIC_CURSOR_INDEX_MASK	((1 << MIC_CURSOR_INDEX_BITS) - 1)
+#define MIC_CURSOR_DETACHED		MIC_CURSOR_INDEX_MASK
+
+// Block completions remembered for MICGetSamples latency; older blocks are
+// extrapolated from the oldest at the measured block interval
+#define MIC_PROFILE_RECORDS		32
+
+// Watchdog: a block is declared lost once it is MIC_WATCHDOG_DEV_SCALE mean
+// deviations later than the mean interval, but never sooner than a quarter
+// block late or later than MIC_WATCHDOG_MAX_BLOCKS blocks
+#define MIC_WATCHDOG_DEV_SCALE	4
+#define MIC_WATCHDOG_MAX_BLOCKS	8
+
+struct MICCommand
+{
+	u32 mask;		// status bits this command replaces
+	u32 bits;
+	u32 flags;
+	s32 result;
+	MICCallback callback;
+};
+
+// A MICGetSamples caller, known by the ring index its last read ended at
+struct MICReader
+{
+	u32 gen;		// cursor generation index belongs to
+	s32 index;		// -1 while unused
+	vu32 pos;		// stream position (samples, low word) of index
+};
+
+// A sync call waiting for its command, linked into the cold block until it
+// returns so that later completions cannot overwrite its result
+struct MICSyncWaiter
+{
+	struct MICSyncWaiter *next;
+	u32 serial;
+	s32 result;
+};
+
+
+// Rarely touched state: request bookkeeping, button debouncing and the EXI
+// trace bounds. Kept apart from the hot block so none of it shares a cache
+// line with the fields the interrupt paths touch.
+struct MICColdBlock
 {
 	s32 result_code;
 	
-	BOOL is_attached;
-	BOOL is_active;
-	
 	lwpq_t thread_queue;
 	
-	MICCallback exi_callback;
-	MICCallback tx_callback;
 	MICCallback detach_callback;
 	MICCallback attach_callback;
 	MICCallback mount_callback;
-	MICCallback set_callback;
 	
-	u32 last_status;
-	u32 status;
+	// Set*/Start/Stop/Reset requests. queue_done counts the commands at the
+	// head that __MICSetCallback has applied but whose callbacks have not run
+	// yet; queue_active is whether the channel will be active once every
+	// queued command has been applied.
+	struct MICCommand queue[MIC_QUEUE_DEPTH];
+	u32 queue_head;
+	u32 queue_count;
+	u32 queue_done;
+	BOOL queue_active;
+	
+	// For the sync calls: queue_serial numbers commands as they are queued,
+	// done_serial counts them as they complete, and each completion hands
+	// its result to the waiter for its number, if there is one
+	u32 queue_serial;
+	u32 done_serial;
+	struct MICSyncWaiter *sync_waiters;
 	
-	// Number of times the hw ringbuffer has been observed overwriting itself
-	// without the driver first reading the data
-	u32 error_count;
+	u32 gain;
+	u32 buff_size;		// size usable (buff_ring_base to end of given buffer)
+	u32 swap_size;		// usable size of the pending swap_base
+	
+	// Auto-resume after hot-unplug: the status word to restore, when the
+	// mic went away, and how many samples the last resume lost
+	BOOL auto_resume;
+	BOOL resume_pending;
+	u32 resume_status;
+	u32 resume_tick;
+	u32 resume_gap;
+	MICCallback resume_callback;
+	
+	// Restart streaming after a watchdog reset instead of leaving the
+	// channel stopped
+	BOOL auto_recover;
+	
+	// Write silence into the ring for each discontinuity so the ring stays
+	// on the wall-clock timebase
+	BOOL gap_fill;
+	
+	// Bytes of the ring start to mirror past its end, as set by MICSetGuard
+	u32 guard_size;
+	
+	// Called in the order added; they outlive MICUnmount, unlike tx_callback
+	MICCallback tx_listeners[MIC_TX_LISTENERS];
+	
+	// Where the latest MICGetSamples/MICGetSamplesMulti callers are, for
+	// ring_overruns and for how much a ring swap has to carry over
+	struct MICReader readers[MIC_READERS];
+	
+	MICDiscontinuity discont[MIC_DISCONT_DEPTH];
+	u32 discont_head;
+	u32 discont_count;
+	
+	u32 button;
+	u32 last_button;
+	u32 button_time_delta;
+	u32 button_time_last;
 	
+	// EXI trace bounds and replay state; trace_cur lives in the hot block
+	u8 *trace_start;
+	u8 *trace_end;
+	u32 trace_mismatch;
+	s16 *replay_dma_data;
+	u32 replay_dma_len;
+	EXICallback replay_dma_callback;
+	
+#ifdef MIC_PROFILE
+	// Stream position (low 32 bits) just past each recent block, and when
+	// it completed
+	u32 profile_end[MIC_PROFILE_RECORDS];
+	u32 profile_tick[MIC_PROFILE_RECORDS];
+	u32 profile_head;
+	u64 profile_start;
+	MICProfile profile;
+#endif
+};
+
+// Everything the EXI interrupt, DMA completion and watchdog paths touch.
+// The block is cache-line aligned so each channel starts on its own line,
+// with the per-block ring fields packed into the first one.
+struct MICControlBlock
+{
 	// The driver manages two ringbuffers: the hardware buffer in the mic which
 	// is small (32|64|128), and the user-supplied buffer which is filled from
 	// the hardware buffer and used as the source of GetSamples.
 	
-	// Hardware parameters
-	// The hw ringbuffer size which generates exi interrupts
-	u32 hw_buff_size;
-	u32 sample_rate;
-	u32 gain;
+	BOOL is_attached;
+	BOOL is_active;
 	
 	// User-supplied buffer management
 	s16 *buff_ring_base;// aligned up from user-supplied ptr
-	u32 buff_size;		// size usable (buff_ring_base to end of given buffer)
 	u32 buff_ring_size;	// size usable (buff_ring_base to max multiple of hw_buff_size)
 	u32 buff_ring_cur;	// current byte in ringbuffer
+	s16 *swap_base;		// ring waiting to replace buff_ring_base at the next block boundary
+	u32 buff_guard_size;	// bytes of the ring start mirrored just past buff_ring_size
 	
-	u32 button;
-	u32 last_button;
-	u32 button_time_delta;
-	u32 button_time_last;
+	// Published for readers that skip IRQ_Disable, see __MICPublishCursor
+	vu32 cursor;
+	vu32 cursor_samples;
+	vu32 cursor_filled;
+	vu32 cursor_written;	// low word of buff_pos, in samples
+	
+	// Hardware parameters
+	// The hw ringbuffer size which generates exi interrupts
+	u32 hw_buff_size;
+	
+	u32 last_status;
+	
+	// Number of times the hw ringbuffer has been observed overwriting itself
+	// without the driver first reading the data
+	u32 error_count;
+	
+	MICCallback exi_callback;
+	MICCallback tx_callback;
+	MICCallback set_callback;
+	u32 tx_listener_count;
+	
+	// EXI trace: records are appended at trace_cur while recording, or
+	// consumed from trace_cur while trace_replay is set
+	u8 *trace_cur;
+	BOOL trace_replay;
 	
-	// Trigger __MICTimeoutCallback if an EXI transfer doesn't complete in time
+	u32 sample_rate;
+	u32 first_block_tick;	// when the first block after MICStart completed
+	u32 last_block_tick;	// when the most recent block completed
+	u64 buff_pos;		// bytes received since MICStart
+	
+	// Set by watchdog recovery until the first block after the restart
+	BOOL is_recovering;
+	u32 recover_tick;	// last block before the stall
+	
+	// Trigger __MICTimeoutCallback if an EXI transfer doesn't complete in time.
+	// The period follows the measured block interval and its mean deviation,
+	// all in ticks.
 	struct timespec timeout;
-} static __MICBlock[2];
+	u32 block_ticks;	// nominal interval for the current status
+	u32 interval_avg;
+	u32 interval_dev;
+	u32 watchdog_ticks;
+	
+	// Driver statistics; unlike error_count these survive unmount and start
+	// and are only cleared by MICResetStats. IRQ-disabled time is summed in
+	// ticks and averaged when read.
+	MICStats stats;
+	u32 irq_disabled_count;
+	u64 irq_disabled_total;
+	
+	struct MICColdBlock *cold;
+} ATTRIBUTE_ALIGN(32);
+
+static struct MICControlBlock __MICBlock[2];
+static struct MICColdBlock __MICCold[2];
+
+// Linked stereo capture: channel 0 is left, channel 1 is right. Each
+// channel's first-block timestamp gives its start time; the channel that
+// started first drops its leading samples so frame n of both lines up.
+struct MICLinkBlock
+{
+	BOOL is_linked;
+	BOOL is_aligned;
+	u32 skip[2];
+	u64 read_pos;	// frames consumed by MICGetLinkedSamples
+} static __MICLink;
 
 
 extern int clock_gettime(struct timespec *tp);
@@ -93,16 +295,65 @@ static syswd_t __timeout[2];
 
 static BOOL __init = FALSE;
 
-#define secs_to_nanosecs_f(sec) \
-	((sec) * 1000000000.)
-#define CalcTimeout(b, h) \
-	(u64)(secs_to_nanosecs_f((1. / h) * (b / sizeof(s16))))
+#ifdef MIC_EVENTLOG
+// Every writer runs in interrupt context (EXI, DMA completion or alarm) and
+// those never nest, so claiming a slot is a plain increment of the head.
+static MICEvent __MICEventLog[MIC_EVENTLOG_SIZE];
+static vu32 __MICEventHead = 0;
+#define MIC_EVENT(chan, type, arg) __MICLogEvent(chan, type, arg)
+// The ring position in hw blocks, as a byte offset overflows the u16 arg
+#define MIC_EVENT_BLOCK(cb) \
+	((cb)->hw_buff_size ? (cb)->buff_ring_cur / (cb)->hw_buff_size : 0)
+#else
+#define MIC_EVENT(chan, type, arg) do {} while (0)
+#endif
+
+#ifdef MIC_PROFILE
+#define MIC_PROFILE_HANDLER(chan, start) __MICProfileHandler(chan, start)
+#else
+#define MIC_PROFILE_HANDLER(chan, start) do { (void)(start); } while (0)
+#endif
+
+// Readers and writers of the published cursor share one core, so only the
+// compiler has to be kept from reordering around it
+#define __MICBarrier() __asm__ __volatile__("" ::: "memory")
+
+#define CalcBlockTicks(b, h) \
+	(u32)((TB_TIMER_CLOCK * 1000.) / h * (b / sizeof(s16)))
+
+// Decoded form of every gain/rate/size combination the status word can
+// hold, indexed by MIC_STATUS_INDEX. Rate 3 decodes as 44100Hz and size 3 as
+// 128 bytes, same as the hardware; encoding always picks the first match.
+struct MICStatusInfo
+{
+	u16 hw_buff_size;
+	u16 sample_rate;
+	u32 bytes_per_sec;
+	u32 block_ticks;	// one hw block's worth of audio, in timebase ticks
+	s32 gain;
+};
+
+#define MIC_STATUS_ENTRY(b, h, g) \
+	{ b, h, h * sizeof(s16), CalcBlockTicks(b, h), g }
+#define MIC_STATUS_GAINS(b, h) \
+	MIC_STATUS_ENTRY(b, h, 0), MIC_STATUS_ENTRY(b, h, 15)
+#define MIC_STATUS_RATES(b) \
+	MIC_STATUS_GAINS(b, 11025), MIC_STATUS_GAINS(b, 22050), \
+	MIC_STATUS_GAINS(b, 44100), MIC_STATUS_GAINS(b, 44100)
+
+static const struct MICStatusInfo __MICStatusTable[32] = {
+	MIC_STATUS_RATES(32), MIC_STATUS_RATES(64), MIC_STATUS_RATES(128), MIC_STATUS_RATES(128),
+};
 
-static const u32 __MICTimeoutTable[] = {
-	CalcTimeout(32, 11025), CalcTimeout(64, 11025), CalcTimeout(128, 11025), CalcTimeout(128, 11025),
-	CalcTimeout(32, 22050), CalcTimeout(64, 22050), CalcTimeout(128, 22050), CalcTimeout(128, 22050),
-	CalcTimeout(32, 44100), CalcTimeout(64, 44100), CalcTimeout(128, 44100), CalcTimeout(128, 44100),
-	CalcTimeout(32, 44100), CalcTimeout(64, 44100), CalcTimeout(128, 44100), CalcTimeout(128, 44100),
+// One channel's ring state as MICGetSamplesMulti copies from it
+struct MICReadSnapshot
+{
+	u32 gen;
+	s32 top;
+	s32 samples_in_ring;
+	u32 filled;
+	s16 *base;
+	u64 written;            // samples since MICStart, the stream position of top
 };
 
 
@@ -111,22 +362,68 @@ void __MICDoUnmount(s32 chan, s32 result);
 s32 __MICUnlockedCallback(s32 chan, s32 dev);
 void __MICMountCallback(s32 chan, s32 result);
 void __MICSetCallback(s32 chan, s32 result);
-void __MICResetCallback(s32 chan, s32 result);
 s32 __MICSync(s32 chan);
+s32 __MICSyncCommand(s32 chan, u32 serial);
+void __MICSyncWatch(s32 chan, struct MICSyncWaiter *waiter, u32 serial);
+s32 __MICSyncWait(s32 chan, struct MICSyncWaiter *waiter);
+void __MICSyncDone(s32 chan, s32 result);
 void __MICSyncCallback(s32 chan, s32 result);
 s32 __MICExtHandler(s32 chan, s32 dev);
 s32 __MICExiHandler(s32 chan, s32 dev);
 s32 __MICTxHandler(s32 chan, s32 dev);
 void __MICAlarmCallback(syswd_t alarm, void *cb_arg);
+void __MICAlarmPoll(s32 chan);
+void __MICDoResume(s32 chan);
 void __MICTimeoutCallback(syswd_t alarm, void *cb_arg);
+void __MICDoTimeout(s32 chan);
+void __MICRecover(s32 chan, u32 status);
+void __MICAddDiscontinuity(s32 chan, u32 reason, u32 samples);
+void __MICOverflow(s32 chan);
+u32 __MICFillSilence(s32 chan, u32 samples);
+void __MICSwapRing(s32 chan);
+u32 __MICRingSize(s32 chan, u32 usable, u32 *guard);
+void __MICMirror(s32 chan, u32 offset, u32 len);
+void __MICWatchdogReset(s32 chan);
+void __MICWatchdogUpdate(s32 chan, u32 interval);
 s32 __MICRawReset(s32 chan);
 s32 __MICRawReadStatus(s32 chan, u32 *status);
 s32 __MICRawWriteStatus(s32 chan, u32 status);
 s32 __MICRawReadDataAsync(s32 chan, s16 *data, u32 len, EXICallback DMACompletion);
 s32 __MICGetControlBlock(s32 chan, BOOL skip_active_check, struct MICControlBlock **micblock);
+s32 __MICCanQueue(s32 chan, BOOL skip_active_check);
+s32 __MICQueueCommand(s32 chan, BOOL skip_active_check, u32 mask, u32 bits, u32 flags, MICCallback callback);
+void __MICCompleteCommands(s32 chan, s32 result);
+void __MICFlushCommands(s32 chan, s32 result);
+void __MICPrepareStart(s32 chan, u32 status);
+s32 __MICLinkAvailable(void);
 void __MICPutControlBlock(struct MICControlBlock *micblock, s32 result);
 BOOL __MICUpdateStatus(s32 chan, u32 status, BOOL dunno);
+s32 __MICFindStatus(u32 status, s32 size, s32 rate, s32 gain);
+u32 __MICEncodeStatus(u32 status, s32 index);
 void __MICUpdateButton(s32 chan);
+void __MICIrqStat(s32 chan, u32 start);
+void __MICPublishCursor(s32 chan, BOOL reconfigured);
+BOOL __MICReadCursor(s32 chan, u32 *top, u32 *samples, u32 *filled, s16 **base, u32 *written);
+void __MICNoteRead(s32 chan, u32 gen, s32 top, s32 samples_in_ring, u32 written, s32 index, s32 end);
+u32 __MICReaderLag(s32 chan);
+void __MICNotifyListeners(s32 chan, s32 result);
+s32 __MICCopySamples(s16 *buffer, const s16 *base, s32 samples_in_ring, s32 top, u32 filled, s32 index, s32 samples);
+void __MICReadSnapshot(s32 chan, struct MICReadSnapshot *snap);
+#ifdef MIC_EVENTLOG
+void __MICLogEvent(s32 chan, u32 type, u32 arg);
+#endif
+#ifdef MIC_PROFILE
+void __MICProfileReset(s32 chan);
+void __MICProfileHandler(s32 chan, u32 start);
+void __MICProfileBlock(s32 chan, u32 tick);
+void __MICProfileRead(s32 chan, u32 index);
+#endif
+void __MICTraceWrite(s32 chan, u32 op, s32 result, u32 value, const void *payload);
+MICTraceEntry* __MICReplayNext(s32 chan, u32 op);
+BOOL __MICExiLock(s32 chan);
+void __MICExiUnlock(s32 chan);
+BOOL __MICExiDeselect(s32 chan);
+BOOL __MICExiProbe(s32 chan);
 
 
 s32 __MICDoMount(s32 chan)
@@ -137,6 +434,7 @@ s32 __MICDoMount(s32 chan)
 	u32 level = IRQ_Disable();
 	
 	cb->is_attached = TRUE;
+	__MICPublishCursor(chan, TRUE);
 	
 	u32 exiID;
 	if (!EXI_GetID(chan, EXI_DEVICE_0, &exiID))
@@ -160,10 +458,10 @@ s32 __MICDoMount(s32 chan)
 	{
 		__MICUpdateStatus(chan, status, FALSE);
 		
-		cb->button = 0;
-		cb->last_button = 0;
-		cb->button_time_delta = 0;
-		cb->button_time_last = gettick();
+		cb->cold->button = 0;
+		cb->cold->last_button = 0;
+		cb->cold->button_time_delta = 0;
+		cb->cold->button_time_last = gettick();
 	
 		if (EXI_Probe(chan))
 		{
@@ -171,10 +469,10 @@ s32 __MICDoMount(s32 chan)
 			EXI_Unlock(chan);
 			IRQ_Restore(level);
 			
-			if (cb->attach_callback)
+			if (cb->cold->attach_callback)
 			{
-				MICCallback attach = cb->attach_callback;
-				cb->attach_callback = NULL;
+				MICCallback attach = cb->cold->attach_callback;
+				cb->cold->attach_callback = NULL;
 				attach(chan, result);
 			}
 			__MICPutControlBlock(cb, result);
@@ -201,21 +499,28 @@ void __MICDoUnmount(s32 chan, s32 result)
 		EXI_RegisterEXICallback(chan, NULL);
 		EXI_Detach(chan);
 		
-		cb->result_code = result;
+		cb->cold->result_code = result;
 		cb->is_attached = FALSE;
 		cb->error_count = 0;
+		__MICPublishCursor(chan, TRUE);
+		__MICNotifyListeners(chan, MIC_RESULT_NOCARD);
 	}
 	else
 	{
-		cb->result_code = MIC_RESULT_NOCARD;
+		cb->cold->result_code = MIC_RESULT_NOCARD;
 	}
 	
+	// An explicit teardown ends any wait for the mic to come back; the ring
+	// may be freed as soon as this returns
+	cb->cold->resume_pending = FALSE;
+	cb->cold->detach_callback = NULL;
+	
 	IRQ_Restore(level);
 	
-	if (cb->attach_callback)
+	if (cb->cold->attach_callback)
 	{
-		MICCallback unmount = cb->attach_callback;
-		cb->attach_callback = NULL;
+		MICCallback unmount = cb->cold->attach_callback;
+		cb->cold->attach_callback = NULL;
 		unmount(chan, result);
 	}
 }
@@ -224,10 +529,10 @@ s32 __MICUnlockedCallback(s32 chan, s32 dev)
 {
 	struct MICControlBlock *cb = &__MICBlock[chan];
 	
-	MICCallback unlocked = cb->mount_callback;
-	if (cb->mount_callback)
+	MICCallback unlocked = cb->cold->mount_callback;
+	if (cb->cold->mount_callback)
 	{
-		cb->mount_callback = NULL;
+		cb->cold->mount_callback = NULL;
 		unlocked(chan, EXI_Probe(chan) ? MIC_RESULT_NOCARD : MIC_RESULT_UNLOCKED);
 	}
 	
@@ -241,10 +546,10 @@ void __MICMountCallback(s32 chan, s32 result)
 	
 	if (result == MIC_RESULT_UNLOCKED)
 	{
-		cb->mount_callback = __MICMountCallback;
+		cb->cold->mount_callback = __MICMountCallback;
 		if (EXI_Lock(chan, EXI_DEVICE_0, __MICUnlockedCallback))
 		{
-			cb->mount_callback = NULL;
+			cb->cold->mount_callback = NULL;
 			__MICDoMount(chan);
 		}
 	}
@@ -256,19 +561,48 @@ void __MICMountCallback(s32 chan, s32 result)
 
 void __MICSetCallback(s32 chan, s32 result)
 {
-	u32 status = __MICBlock[chan].status;
-	
-	if (__MICRawWriteStatus(chan, status) >= MIC_RESULT_READY)
-		__MICUpdateStatus(chan, status, FALSE);
-}
-
-void __MICResetCallback(s32 chan, s32 result)
-{
-	u32 status;
+	struct MICControlBlock *cb = &__MICBlock[chan];
+	struct MICColdBlock *cold = cb->cold;
 	
-	if (__MICRawReset(chan) >= MIC_RESULT_READY)
-		if (__MICRawReadStatus(chan, &status) >= MIC_RESULT_READY)
+	while (cold->queue_done < cold->queue_count)
+	{
+		struct MICCommand *cmd = &cold->queue[(cold->queue_head + cold->queue_done) % MIC_QUEUE_DEPTH];
+		
+		if (cmd->flags & MIC_COMMAND_RESET)
+		{
+			u32 status;
+			if ((cmd->result = __MICRawReset(chan)) >= MIC_RESULT_READY &&
+				(cmd->result = __MICRawReadStatus(chan, &status)) >= MIC_RESULT_READY)
+				__MICUpdateStatus(chan, status, FALSE);
+			
+			cold->queue_done++;
+			continue;
+		}
+		
+		// Fold this command and every status change queued behind it, up to
+		// the next reset, into one write
+		u32 status = cb->last_status;
+		u32 flags = 0;
+		u32 end;
+		for (end = cold->queue_done; end < cold->queue_count; end++)
+		{
+			cmd = &cold->queue[(cold->queue_head + end) % MIC_QUEUE_DEPTH];
+			if (cmd->flags & MIC_COMMAND_RESET)
+				break;
+			status = (status & ~cmd->mask) | cmd->bits;
+			flags |= cmd->flags;
+		}
+		
+		if (flags & MIC_COMMAND_START)
+			__MICPrepareStart(chan, status);
+		
+		s32 write_result = __MICRawWriteStatus(chan, status);
+		if (write_result >= MIC_RESULT_READY)
 			__MICUpdateStatus(chan, status, FALSE);
+		
+		for (; cold->queue_done < end; cold->queue_done++)
+			cold->queue[(cold->queue_head + cold->queue_done) % MIC_QUEUE_DEPTH].result = write_result;
+	}
 }
 
 s32 __MICSync(s32 chan)
@@ -276,18 +610,77 @@ s32 __MICSync(s32 chan)
 	struct MICControlBlock *cb = &__MICBlock[chan];
 	u32 level = IRQ_Disable();
 	
-	while (cb->result_code == MIC_RESULT_BUSY)
+	while (cb->cold->result_code == MIC_RESULT_BUSY)
 	{
-		LWP_ThreadSleep(cb->thread_queue);
+		LWP_ThreadSleep(cb->cold->thread_queue);
 	}
 	
 	IRQ_Restore(level);
-	return cb->result_code;
+	return cb->cold->result_code;
+}
+
+// Wait for the command numbered serial and return its own result, however
+// many commands queued behind it are still to run. Called with interrupts
+// off, straight after queueing it.
+s32 __MICSyncCommand(s32 chan, u32 serial)
+{
+	struct MICSyncWaiter waiter;
+	__MICSyncWatch(chan, &waiter, serial);
+	return __MICSyncWait(chan, &waiter);
+}
+
+// Collect the result of the command numbered serial into waiter. Called with
+// interrupts off, before they are next enabled after queueing it.
+void __MICSyncWatch(s32 chan, struct MICSyncWaiter *waiter, u32 serial)
+{
+	struct MICColdBlock *cold = &__MICCold[chan];
+	
+	waiter->serial = serial;
+	// Kept if a remount drops the command without completing it
+	waiter->result = MIC_RESULT_NOCARD;
+	waiter->next = cold->sync_waiters;
+	cold->sync_waiters = waiter;
+}
+
+// Called with interrupts off
+s32 __MICSyncWait(s32 chan, struct MICSyncWaiter *waiter)
+{
+	struct MICColdBlock *cold = &__MICCold[chan];
+	
+	while ((s32)(cold->done_serial - waiter->serial) <= 0)
+	{
+		LWP_ThreadSleep(cold->thread_queue);
+	}
+	
+	struct MICSyncWaiter **link = &cold->sync_waiters;
+	while (*link != waiter)
+		link = &(*link)->next;
+	*link = waiter->next;
+	
+	return waiter->result;
+}
+
+// Number the next completed command, and hand its result to the sync call
+// waiting for it. Called with interrupts off.
+void __MICSyncDone(s32 chan, s32 result)
+{
+	struct MICColdBlock *cold = &__MICCold[chan];
+	const u32 serial = cold->done_serial++;
+	
+	struct MICSyncWaiter *waiter;
+	for (waiter = cold->sync_waiters; waiter != NULL; waiter = waiter->next)
+	{
+		if (waiter->serial == serial)
+		{
+			waiter->result = result;
+			break;
+		}
+	}
 }
 
 void __MICSyncCallback(s32 chan, s32 result)
 {
-	LWP_ThreadBroadcast(__MICBlock[chan].thread_queue);
+	LWP_ThreadBroadcast(__MICCold[chan].thread_queue);
 }
 
 s32 __MICExtHandler(s32 chan, s32 dev)
@@ -297,22 +690,38 @@ s32 __MICExtHandler(s32 chan, s32 dev)
 	if (cb->is_attached)
 	{
 		EXI_RegisterEXICallback(chan, NULL);
-		cb->result_code = MIC_RESULT_NOCARD;
+		SYS_CancelAlarm(__timeout[chan]);
+		
+		if (cb->cold->auto_resume)
+		{
+			cb->cold->resume_status = (cb->last_status & ~(MIC_STATUS_ACTIVE | MIC_STATUS_BUFOVRFLW)) |
+				(cb->is_active ? MIC_STATUS_ACTIVE : 0);
+			cb->cold->resume_tick = gettick();
+			cb->cold->resume_pending = TRUE;
+		}
+		
+		cb->cold->result_code = MIC_RESULT_NOCARD;
 		cb->is_attached = FALSE;
 		cb->is_active = FALSE;
 		cb->error_count = 0;
+		__MICPublishCursor(chan, TRUE);
 		
-		MICCallback attach = cb->attach_callback;
+		__MICFlushCommands(chan, MIC_RESULT_NOCARD);
+		__MICNotifyListeners(chan, MIC_RESULT_NOCARD);
+		
+		MICCallback attach = cb->cold->attach_callback;
 		if (attach)
 		{
-			cb->attach_callback = NULL;
+			cb->cold->attach_callback = NULL;
 			attach(chan, MIC_RESULT_NOCARD);
 		}
 		
-		MICCallback detach = cb->detach_callback;
+		// Keep the detach callback armed if the channel will come back by itself
+		MICCallback detach = cb->cold->detach_callback;
 		if (detach)
 		{
-			cb->detach_callback = NULL;
+			if (!cb->cold->resume_pending)
+				cb->cold->detach_callback = NULL;
 			detach(chan, MIC_RESULT_NOCARD);
 		}
 	}
@@ -323,15 +732,27 @@ s32 __MICExtHandler(s32 chan, s32 dev)
 
 s32 __MICExiHandler(s32 chan, s32 dev)
 {
+	u32 handler_start = gettick();
+	
 	SYS_CancelAlarm(__timeout[chan]);
 	
 	struct MICControlBlock *cb = &__MICBlock[chan];
 	
+	cb->stats.exi_interrupts++;
+	MIC_EVENT(chan, MIC_EVENT_EXI_IRQ, cb->is_active);
+	
 	if (cb->is_attached && cb->is_active)
 	{
 		s32 result_code = MIC_RESULT_FATAL_ERROR;
 		
-		if (EXI_Lock(chan, EXI_DEVICE_0, NULL))
+		__MICTraceWrite(chan, MIC_TRACE_EXI_IRQ, MIC_RESULT_READY, 0, NULL);
+		
+		if (!__MICExiLock(chan))
+		{
+			cb->stats.lock_failures++;
+			MIC_EVENT(chan, MIC_EVENT_LOCK_FAIL, MIC_EVENT_EXI_IRQ);
+		}
+		else
 		{
 			u32 status;
 			if (((result_code = __MICRawReadStatus(chan, &status)) >= MIC_RESULT_READY) &&
@@ -339,7 +760,7 @@ s32 __MICExiHandler(s32 chan, s32 dev)
 			{
 				if (status & MIC_STATUS_BUFOVRFLW)
 				{
-					cb->error_count++;
+					__MICOverflow(chan);
 					status &= ~MIC_STATUS_BUFOVRFLW;
 				}
 				
@@ -359,13 +780,13 @@ s32 __MICExiHandler(s32 chan, s32 dev)
 						goto skip_unlock;
 					}
 				}
-				else if (!EXI_Probe(chan))
+				else if (!__MICExiProbe(chan))
 				{
 					result_code = MIC_RESULT_NOCARD;
 				}
 			}
 			
-			EXI_Unlock(chan);
+			__MICExiUnlock(chan);
 		}
 	skip_unlock:
 		
@@ -375,34 +796,62 @@ s32 __MICExiHandler(s32 chan, s32 dev)
 		}
 		
 		if (cb->set_callback)
-		{
-			cb->set_callback = NULL;
-			
-			if (cb->attach_callback)
-			{
-				cb->attach_callback(chan, result_code);
-				cb->attach_callback = NULL;
-			}
-			
-			__MICPutControlBlock(cb, result_code);
-		}
+			__MICCompleteCommands(chan, result_code);
 	}
 	
+	MIC_PROFILE_HANDLER(chan, handler_start);
+	
 	// This is used as exi->CallbackEXI, which does not have checked return value
 	return 0;
 }
 
 s32 __MICTxHandler(s32 chan, s32 dev)
 {
+	u32 handler_start = gettick();
 	s32 result_code = MIC_RESULT_NOCARD;
 	struct MICControlBlock *cb = &__MICBlock[chan];
 	
+	__MICTraceWrite(chan, MIC_TRACE_DMA_DONE, MIC_RESULT_READY, cb->hw_buff_size,
+		cb->buff_ring_base + cb->buff_ring_cur / sizeof(s16));
+	
+	if (cb->buff_ring_cur < cb->buff_guard_size)
+		__MICMirror(chan, cb->buff_ring_cur, cb->hw_buff_size);
+	
 	cb->buff_ring_cur += cb->hw_buff_size;
 	
 	if (cb->buff_ring_cur >= cb->buff_ring_size)
 		cb->buff_ring_cur = 0;
 	
-	if (EXI_Deselect(chan))
+	u32 now = gettick();
+	if (cb->buff_pos == 0)
+		cb->first_block_tick = now;
+	else if (!cb->is_recovering)
+		__MICWatchdogUpdate(chan, now - cb->last_block_tick);
+	cb->last_block_tick = now;
+	
+	if (cb->is_recovering)
+	{
+		u32 latency = cb->last_block_tick - cb->recover_tick;
+		cb->stats.recovery_latency_last = latency;
+		if (latency > cb->stats.recovery_latency_max)
+			cb->stats.recovery_latency_max = latency;
+		cb->is_recovering = FALSE;
+	}
+	cb->buff_pos += cb->hw_buff_size;
+	
+#ifdef MIC_PROFILE
+	__MICProfileBlock(chan, now);
+#endif
+	
+	if (cb->swap_base)
+		__MICSwapRing(chan);
+	
+	__MICPublishCursor(chan, FALSE);
+	
+	cb->stats.dma_completions++;
+	MIC_EVENT(chan, MIC_EVENT_DMA_DONE, MIC_EVENT_BLOCK(cb));
+	
+	if (__MICExiDeselect(chan))
 	{
 		u32 status;
 		if (((result_code = __MICRawReadStatus(chan, &status)) >= MIC_RESULT_READY) &&
@@ -410,13 +859,13 @@ s32 __MICTxHandler(s32 chan, s32 dev)
 		{
 			if (status & MIC_STATUS_BUFOVRFLW)
 			{
-				cb->error_count++;
+				__MICOverflow(chan);
 				status &= ~MIC_STATUS_BUFOVRFLW;
 			}
 			
 			__MICUpdateButton(chan);
 			
-			if (EXI_Probe(chan))
+			if (__MICExiProbe(chan))
 			{
 				SYS_SetAlarm(__timeout[chan], &cb->timeout, __MICTimeoutCallback, NULL);
 				result_code = MIC_RESULT_READY;
@@ -424,11 +873,15 @@ s32 __MICTxHandler(s32 chan, s32 dev)
 		}
 	}
 	
-	EXI_Unlock(chan);
+	__MICExiUnlock(chan);
 	
 	if (cb->tx_callback)
 		cb->tx_callback(chan, result_code);
 	
+	__MICNotifyListeners(chan, result_code);
+	
+	MIC_PROFILE_HANDLER(chan, handler_start);
+	
 	// This is used as exi->CallbackTC, which does not have checked return value
 	return 0;
 }
@@ -438,68 +891,461 @@ void __MICAlarmCallback(syswd_t alarm, void *cb_arg)
 	int chan;
 	for (chan = 0; chan < 2; chan++)
 	{
-		struct MICControlBlock *cb = &__MICBlock[chan];
+		// A replayed channel is only polled from the replay loop
+		if (!__MICBlock[chan].trace_replay)
+			__MICAlarmPoll(chan);
+	}
+}
+
+void __MICAlarmPoll(s32 chan)
+{
+	struct MICControlBlock *cb = &__MICBlock[chan];
+	
+	if (!cb->is_attached)
+	{
+		if (cb->cold->resume_pending)
+			__MICDoResume(chan);
+		return;
+	}
+	
+	if (cb->is_active)
+		return;
+	
+	cb->stats.alarm_wakeups++;
+	MIC_EVENT(chan, MIC_EVENT_ALARM, 0);
+	
+	if (!__MICExiLock(chan))
+	{
+		cb->stats.lock_failures++;
+		MIC_EVENT(chan, MIC_EVENT_LOCK_FAIL, MIC_EVENT_ALARM);
+	}
+	else
+	{
+		u32 status;
+		s32 result;
+		
+		__MICTraceWrite(chan, MIC_TRACE_ALARM, MIC_RESULT_READY, 0, NULL);
 		
-		if (cb->is_attached && !cb->is_active &&
-			EXI_Lock(chan, EXI_DEVICE_0, NULL))
+		if ((result = __MICRawReadStatus(chan, &status)) >= MIC_RESULT_READY &&
+			__MICUpdateStatus(chan, status, TRUE))
 		{
-			u32 status;
-			s32 result;
-			
-			if ((result = __MICRawReadStatus(chan, &status)) >= MIC_RESULT_READY &&
-				__MICUpdateStatus(chan, status, TRUE))
-			{
-				__MICUpdateButton(chan);
-				
-				if (cb->set_callback)
-					cb->set_callback(chan, result);
-			}
-			
-			EXI_Unlock(chan);
+			__MICUpdateButton(chan);
 			
 			if (cb->set_callback)
-			{
-				cb->set_callback = NULL;
-				
-				if (cb->attach_callback)
-				{
-					cb->attach_callback(chan, result);
-					cb->attach_callback = NULL;
-				}
-				
-				__MICPutControlBlock(cb, result);
-			}
+				cb->set_callback(chan, result);
+		}
+		
+		__MICExiUnlock(chan);
+		
+		if (cb->set_callback)
+			__MICCompleteCommands(chan, result);
+	}
+}
+
+void __MICDoResume(s32 chan)
+{
+	struct MICControlBlock *cb = &__MICBlock[chan];
+	struct MICColdBlock *cold = cb->cold;
+	
+	// Nothing in the slot yet, or it is mid-transfer
+	if (EXI_ProbeEx(chan) <= 0)
+		return;
+	
+	if ((EXI_GetState(chan) & EXI_FLAG_ATTACH) || !EXI_Attach(chan, __MICExtHandler))
+		return;
+	
+	if (!EXI_Lock(chan, EXI_DEVICE_0, NULL))
+	{
+		cb->stats.lock_failures++;
+		MIC_EVENT(chan, MIC_EVENT_LOCK_FAIL, MIC_EVENT_RESUME);
+		EXI_Detach(chan);
+		return;
+	}
+	
+	s32 result;
+	u32 exiID;
+	if (!EXI_GetID(chan, EXI_DEVICE_0, &exiID))
+	{
+		result = MIC_RESULT_NOCARD;
+	}
+	else if (exiID != MIC_EXI_ID)
+	{
+		result = MIC_RESULT_WRONGDEVICE;
+	}
+	else
+	{
+		// A freshly inserted mic powers up idle, so unlike __MICDoMount there
+		// is no reset or status read: one status write restores the old
+		// configuration and, if it was streaming, restarts it. The ring and
+		// its cursor are left where they were.
+		cb->is_attached = TRUE;
+		__MICPublishCursor(chan, TRUE);
+		result = __MICRawWriteStatus(chan, cold->resume_status);
+	}
+	
+	if (result < MIC_RESULT_READY)
+	{
+		cb->is_attached = FALSE;
+		__MICPublishCursor(chan, TRUE);
+		EXI_Unlock(chan);
+		EXI_Detach(chan);
+		
+		// Something other than a mic went in; stop waiting for one
+		if (result == MIC_RESULT_WRONGDEVICE)
+		{
+			cold->resume_pending = FALSE;
+			cold->detach_callback = NULL;
+			if (cold->resume_callback)
+				cold->resume_callback(chan, result);
 		}
+		return;
 	}
+	
+	u32 elapsed = gettick() - cold->resume_tick;
+	cold->resume_gap = (u32)((u64)elapsed * cb->sample_rate / (TB_TIMER_CLOCK * 1000));
+	cold->resume_pending = FALSE;
+	cold->result_code = MIC_RESULT_READY;
+	cold->button = 0;
+	cold->last_button = 0;
+	cold->button_time_delta = 0;
+	cold->button_time_last = gettick();
+	
+	__MICUpdateStatus(chan, cold->resume_status, FALSE);
+	
+	// Measure the first interval from the restart, not from before the unplug
+	cb->last_block_tick = gettick();
+	
+	cb->stats.resumes++;
+	MIC_EVENT(chan, MIC_EVENT_RESUME, (cold->resume_gap > 0xffff) ? 0xffff : cold->resume_gap);
+	if (cold->resume_status & MIC_STATUS_ACTIVE)
+		__MICAddDiscontinuity(chan, MIC_DISCONT_RESUME, cold->resume_gap);
+	
+	EXI_RegisterEXICallback(chan, __MICExiHandler);
+	EXI_Unlock(chan);
+	
+	if (cold->resume_callback)
+		cold->resume_callback(chan, MIC_RESULT_READY);
 }
 
 void __MICTimeoutCallback(syswd_t alarm, void *cb_arg)
 {
 	s32 chan = (alarm == __timeout[0]) ? 0 : 1;
+	
+	if (!__MICBlock[chan].trace_replay)
+		__MICDoTimeout(chan);
+}
+
+void __MICDoTimeout(s32 chan)
+{
 	struct MICControlBlock *cb = &__MICBlock[chan];
 	
 	if (cb->is_attached)
 	{
-		if (EXI_Lock(chan, EXI_DEVICE_0, NULL))
+		__MICTraceWrite(chan, MIC_TRACE_TIMEOUT, MIC_RESULT_READY, 0, NULL);
+		
+		if (__MICExiLock(chan))
 		{
+			cb->stats.timeout_resets++;
+			MIC_EVENT(chan, MIC_EVENT_TIMEOUT, MIC_EVENT_BLOCK(cb));
+			u32 prev_status = cb->last_status;
+			BOOL was_active = cb->is_active;
 			cb->is_active = FALSE;
 			__MICRawReset(chan);
 			u32 status;
 			__MICRawReadStatus(chan, &status);
 			__MICUpdateStatus(chan, status, FALSE);
-			EXI_Unlock(chan);
+			if (was_active && cb->cold->auto_recover)
+				__MICRecover(chan, prev_status);
+			if (was_active && !cb->is_active)
+				__MICNotifyListeners(chan, MIC_RESULT_INVALID_STATE);
+			__MICExiUnlock(chan);
 		}
 		else
 		{
+			cb->stats.lock_failures++;
+			MIC_EVENT(chan, MIC_EVENT_LOCK_FAIL, MIC_EVENT_TIMEOUT);
 			SYS_SetAlarm(__timeout[chan], &cb->timeout, __MICTimeoutCallback, NULL);
 		}
 	}
 }
 
-s32 __MICRawReset(s32 chan)
+void __MICRecover(s32 chan, u32 status)
 {
-	s32 result = MIC_RESULT_NOCARD;
-	u32 level = IRQ_Disable();
+	struct MICControlBlock *cb = &__MICBlock[chan];
+	
+	// Put back the status the stream was running with; the ring cursor and
+	// position carry on from where the stall began
+	status = (status & ~MIC_STATUS_BUFOVRFLW) | MIC_STATUS_ACTIVE;
+	if (__MICRawWriteStatus(chan, status) < MIC_RESULT_READY)
+		return;
+	
+	__MICUpdateStatus(chan, status, FALSE);
+	
+	u32 now = gettick();
+	u32 stall_start = cb->buff_pos ? cb->last_block_tick : now;
+	u32 lost = (u32)((u64)(now - stall_start) * cb->sample_rate / (TB_TIMER_CLOCK * 1000));
+	
+	cb->is_recovering = TRUE;
+	cb->recover_tick = stall_start;
+	cb->stats.recoveries++;
+	MIC_EVENT(chan, MIC_EVENT_RECOVER, (lost > 0xffff) ? 0xffff : lost);
+	__MICAddDiscontinuity(chan, MIC_DISCONT_TIMEOUT, lost);
+}
+
+void __MICAddDiscontinuity(s32 chan, u32 reason, u32 samples)
+{
+	struct MICControlBlock *cb = &__MICBlock[chan];
+	struct MICColdBlock *cold = cb->cold;
+	MICDiscontinuity *d;
+	
+	u32 level = IRQ_Disable();
+	
+	u64 position = cb->buff_pos / sizeof(s16);
+	u32 filled = cold->gap_fill ? __MICFillSilence(chan, samples) : 0;
+	
+	// When nobody is collecting, fold into the newest record rather than
+	// lose track of the samples
+	if (cold->discont_count == MIC_DISCONT_DEPTH)
+	{
+		d = &cold->discont[(cold->discont_head + MIC_DISCONT_DEPTH - 1) % MIC_DISCONT_DEPTH];
+		d->samples += samples;
+		d->filled += filled;
+	}
+	else
+	{
+		d = &cold->discont[(cold->discont_head + cold->discont_count) % MIC_DISCONT_DEPTH];
+		d->position = position;
+		d->samples = samples;
+		d->filled = filled;
+		d->reason = reason;
+		cold->discont_count++;
+	}
+	
+	IRQ_Restore(level);
+}
+
+void __MICOverflow(s32 chan)
+{
+	struct MICControlBlock *cb = &__MICBlock[chan];
+	const u32 block = cb->hw_buff_size / sizeof(s16);
+	
+	cb->error_count++;
+	cb->stats.hw_overflows++;
+	MIC_EVENT(chan, MIC_EVENT_OVERFLOW, MIC_EVENT_BLOCK(cb));
+	
+	// The mic overwrote at least one block. If it has been longer than that
+	// since the last block completed, everything beyond the block it still
+	// holds is gone.
+	u32 lost = block;
+	if (cb->buff_pos)
+	{
+		u32 elapsed = (u32)((u64)(gettick() - cb->last_block_tick) * cb->sample_rate / (TB_TIMER_CLOCK * 1000));
+		if (elapsed > 2 * block)
+			lost = elapsed - block;
+	}
+	
+	__MICAddDiscontinuity(chan, MIC_DISCONT_OVERFLOW, lost);
+}
+
+u32 __MICFillSilence(s32 chan, u32 samples)
+{
+	struct MICControlBlock *cb = &__MICBlock[chan];
+	
+	if (cb->hw_buff_size == 0 || cb->buff_ring_size <= cb->hw_buff_size)
+		return 0;
+	
+	// The DMA target has to stay block aligned, so fill whole blocks
+	// (rounded to nearest), and never more than would reach the oldest one.
+	// The rest stays in the record's samples - filled for the consumer.
+	const u32 block = cb->hw_buff_size / sizeof(s16);
+	u32 max_blocks = cb->buff_ring_size / cb->hw_buff_size - 1;
+	if (max_blocks > MIC_GAPFILL_BLOCKS)
+		max_blocks = MIC_GAPFILL_BLOCKS;
+	u32 blocks = (samples + block / 2) / block;
+	if (blocks > max_blocks)
+		blocks = max_blocks;
+	
+	u32 irq_start = gettick();
+	u32 i;
+	for (i = 0; i < blocks; i++)
+	{
+		memset(cb->buff_ring_base + cb->buff_ring_cur / sizeof(s16), 0, cb->hw_buff_size);
+		if (cb->buff_ring_cur < cb->buff_guard_size)
+			__MICMirror(chan, cb->buff_ring_cur, cb->hw_buff_size);
+		cb->buff_ring_cur += cb->hw_buff_size;
+		if (cb->buff_ring_cur >= cb->buff_ring_size)
+			cb->buff_ring_cur = 0;
+	}
+	cb->buff_pos += blocks * cb->hw_buff_size;
+	__MICPublishCursor(chan, FALSE);
+	__MICIrqStat(chan, irq_start);
+	
+	return blocks * block;
+}
+
+void __MICWatchdogReset(s32 chan)
+{
+	struct MICControlBlock *cb = &__MICBlock[chan];
+	
+	// Start out expecting a quarter block of jitter, i.e. a two block timeout
+	cb->interval_avg = cb->block_ticks;
+	cb->interval_dev = cb->block_ticks / 4;
+	cb->watchdog_ticks = cb->interval_avg + MIC_WATCHDOG_DEV_SCALE * cb->interval_dev;
+	cb->timeout.tv_sec = 0;
+	cb->timeout.tv_nsec = ticks_to_nanosecs(cb->watchdog_ticks);
+}
+
+void __MICWatchdogUpdate(s32 chan, u32 interval)
+{
+	struct MICControlBlock *cb = &__MICBlock[chan];
+	const u32 min = cb->block_ticks + cb->block_ticks / 4;
+	const u32 max = cb->block_ticks * MIC_WATCHDOG_MAX_BLOCKS;
+	
+	// An interval the watchdog should have caught (it couldn't get the bus)
+	// would otherwise drag the average up for a long time
+	if (interval > max)
+		interval = max;
+	
+	// Same smoothing as a TCP retransmit timer: 1/8 for the mean, 1/4 for
+	// the deviation
+	s32 err = (s32)(interval - cb->interval_avg);
+	cb->interval_avg += err / 8;
+	cb->interval_dev = (s32)cb->interval_dev + (((err < 0) ? -err : err) - (s32)cb->interval_dev) / 4;
+	
+	u32 ticks = cb->interval_avg + MIC_WATCHDOG_DEV_SCALE * cb->interval_dev;
+	if (ticks < min)
+		ticks = min;
+	else if (ticks > max)
+		ticks = max;
+	
+	if (ticks != cb->watchdog_ticks)
+	{
+		cb->watchdog_ticks = ticks;
+		cb->timeout.tv_nsec = ticks_to_nanosecs(ticks);
+	}
+}
+
+void __MICSwapRing(s32 chan)
+{
+	struct MICControlBlock *cb = &__MICBlock[chan];
+	struct MICColdBlock *cold = cb->cold;
+	
+	const u32 old_size = cb->buff_ring_size;
+	u32 new_guard;
+	const u32 new_size = __MICRingSize(chan, cold->swap_size, &new_guard);
+	
+	// The hw block size changed under the pending swap and the new buffer
+	// can't hold a block; keep the old ring
+	if (new_size == 0)
+	{
+		cb->swap_base = NULL;
+		return;
+	}
+	
+	// Keep the top where it is when it fits, so indices at or just behind it
+	// stay valid; a top that has just wrapped to 0 is treated as the old end.
+	// Linked reads go by stream position and need the top at buff_pos modulo
+	// the ring, so a linked channel is realigned instead.
+	u32 top = cb->buff_ring_cur;
+	if (top == 0 && cb->buff_pos)
+		top = old_size;
+	u32 new_top;
+	if (__MICLink.is_linked)
+		new_top = (u32)(cb->buff_pos % new_size);
+	else
+		new_top = (top < new_size) ? top : top % new_size;
+	
+	// Move the unread samples across (the reader's lag plus the block that
+	// just landed), each keeping its distance behind the top, in runs that
+	// don't wrap either ring. Older samples read as silence.
+	u32 keep = (old_size < new_size) ? old_size : new_size;
+	if (keep > cb->buff_pos)
+		keep = cb->buff_pos;
+	const u32 unread = __MICReaderLag(chan) * sizeof(s16);
+	if (keep > unread + cb->hw_buff_size)
+		keep = unread + cb->hw_buff_size;
+	
+	u32 irq_start = gettick();
+	
+	u32 src = top;
+	u32 dst = new_top;
+	while (keep)
+	{
+		if (src == 0)
+			src = old_size;
+		if (dst == 0)
+			dst = new_size;
+		
+		u32 run = keep;
+		if (run > src)
+			run = src;
+		if (run > dst)
+			run = dst;
+		
+		src -= run;
+		dst -= run;
+		memcpy((u8*)cb->swap_base + dst, (u8*)cb->buff_ring_base + src, run);
+		keep -= run;
+	}
+	
+	__MICIrqStat(chan, irq_start);
+	
+	cb->buff_ring_base = cb->swap_base;
+	cb->buff_ring_size = new_size;
+	cb->buff_guard_size = new_guard;
+	cb->buff_ring_cur = (new_top >= new_size) ? 0 : new_top;
+	cold->buff_size = cold->swap_size;
+	cb->swap_base = NULL;
+	__MICMirror(chan, 0, cb->buff_guard_size);
+	__MICPublishCursor(chan, TRUE);
+}
+
+// Ring size for a usable buffer of the given size, once the guard region is
+// set aside, and the guard that would be in effect: at most half the
+// buffer, and no more than the ring itself. 0 if no hw block fits.
+u32 __MICRingSize(s32 chan, u32 usable, u32 *guard)
+{
+	struct MICControlBlock *cb = &__MICBlock[chan];
+	
+	*guard = 0;
+	if (cb->hw_buff_size == 0 || usable < cb->hw_buff_size)
+		return 0;
+	
+	u32 g = cb->cold->guard_size;
+	if (g > usable / 2)
+		g = (usable / 2) & ~(sizeof(s16) - 1);
+	if (usable - g < cb->hw_buff_size)
+		g = usable - cb->hw_buff_size;
+	
+	const u32 size = cb->hw_buff_size * ((usable - g) / cb->hw_buff_size);
+	*guard = (g < size) ? g : size;
+	
+	return size;
+}
+
+// Copy the ring bytes at offset into the guard region, as far as it reaches
+void __MICMirror(s32 chan, u32 offset, u32 len)
+{
+	struct MICControlBlock *cb = &__MICBlock[chan];
+	
+	if (offset >= cb->buff_guard_size)
+		return;
+	if (len > cb->buff_guard_size - offset)
+		len = cb->buff_guard_size - offset;
+	
+	memcpy((u8*)cb->buff_ring_base + cb->buff_ring_size + offset,
+		(u8*)cb->buff_ring_base + offset, len);
+}
+
+s32 __MICRawReset(s32 chan)
+{
+	s32 result = MIC_RESULT_NOCARD;
+	
+	if (__MICBlock[chan].trace_replay)
+		return MIC_RESULT_READY;
+	
+	u32 level = IRQ_Disable();
+	u32 irq_start = gettick();
 	
 	if (EXI_Select(chan, EXI_DEVICE_0, EXI_SPEED16MHZ))
 	{
@@ -515,6 +1361,7 @@ s32 __MICRawReset(s32 chan)
 			result = MIC_RESULT_READY;
 	}
 	
+	__MICIrqStat(chan, irq_start);
 	IRQ_Restore(level);
 	return result;
 }
@@ -522,7 +1369,22 @@ s32 __MICRawReset(s32 chan)
 s32 __MICRawReadStatus(s32 chan, u32 *status)
 {
 	s32 result = MIC_RESULT_NOCARD;
+	
+	if (__MICBlock[chan].trace_replay)
+	{
+		MICTraceEntry *entry = __MICReplayNext(chan, MIC_TRACE_READ_STATUS);
+		if (entry)
+		{
+			*status = entry->value;
+			result = entry->result;
+		}
+		return result;
+	}
+	
 	u32 level = IRQ_Disable();
+	u32 irq_start = gettick();
+	
+	__MICBlock[chan].stats.status_reads++;
 	
 	if (EXI_Select(chan, EXI_DEVICE_0, EXI_SPEED16MHZ))
 	{
@@ -543,6 +1405,9 @@ s32 __MICRawReadStatus(s32 chan, u32 *status)
 			result = MIC_RESULT_READY;
 	}
 	
+	__MICTraceWrite(chan, MIC_TRACE_READ_STATUS, result, *status, NULL);
+	
+	__MICIrqStat(chan, irq_start);
 	IRQ_Restore(level);
 	return result;
 }
@@ -550,7 +1415,23 @@ s32 __MICRawReadStatus(s32 chan, u32 *status)
 s32 __MICRawWriteStatus(s32 chan, u32 status)
 {
 	s32 result = MIC_RESULT_NOCARD;
+	
+	if (__MICBlock[chan].trace_replay)
+	{
+		MICTraceEntry *entry = __MICReplayNext(chan, MIC_TRACE_WRITE_STATUS);
+		if (entry)
+		{
+			if (entry->value != (status & 0xffff))
+				__MICCold[chan].trace_mismatch++;
+			result = entry->result;
+		}
+		return result;
+	}
+	
 	u32 level = IRQ_Disable();
+	u32 irq_start = gettick();
+	
+	__MICBlock[chan].stats.status_writes++;
 	
 	if (EXI_Select(chan, EXI_DEVICE_0, EXI_SPEED16MHZ))
 	{
@@ -566,6 +1447,9 @@ s32 __MICRawWriteStatus(s32 chan, u32 status)
 			result = MIC_RESULT_READY;
 	}
 	
+	__MICTraceWrite(chan, MIC_TRACE_WRITE_STATUS, result, status & 0xffff, NULL);
+	
+	__MICIrqStat(chan, irq_start);
 	IRQ_Restore(level);
 	return result;
 }
@@ -573,10 +1457,27 @@ s32 __MICRawWriteStatus(s32 chan, u32 status)
 s32 __MICRawReadDataAsync(s32 chan, s16 *data, u32 len, EXICallback DMACompletion)
 {
 	s32 result = MIC_RESULT_NOCARD;
+	struct MICControlBlock *cb = &__MICBlock[chan];
+	
+	if (cb->trace_replay)
+	{
+		// The payload is delivered when the replay loop reaches the
+		// matching MIC_TRACE_DMA_DONE record
+		MICTraceEntry *entry = __MICReplayNext(chan, MIC_TRACE_READ_DATA);
+		if (entry)
+		{
+			cb->cold->replay_dma_data = data;
+			cb->cold->replay_dma_len = len;
+			cb->cold->replay_dma_callback = DMACompletion;
+			result = entry->result;
+		}
+		return result;
+	}
 	
 	DCInvalidateRange(data, len);
 	
 	u32 level = IRQ_Disable();
+	u32 irq_start = gettick();
 	
 	if (EXI_Select(chan, EXI_DEVICE_0, EXI_SPEED16MHZ))
 	{
@@ -594,6 +1495,9 @@ s32 __MICRawReadDataAsync(s32 chan, s16 *data, u32 len, EXICallback DMACompletio
 			EXI_Deselect(chan);
 	}
 	
+	__MICTraceWrite(chan, MIC_TRACE_READ_DATA, result, len, NULL);
+	
+	__MICIrqStat(chan, irq_start);
 	IRQ_Restore(level);
 	return result;
 }
@@ -609,15 +1513,18 @@ s32 __MICGetControlBlock(s32 chan, BOOL skip_active_check, struct MICControlBloc
 	{
 		if (skip_active_check || !cb->is_active)
 		{
-			if (cb->result_code != MIC_RESULT_BUSY)
+			if (cb->cold->result_code != MIC_RESULT_BUSY)
 			{
-				cb->result_code = MIC_RESULT_BUSY;
+				cb->cold->result_code = MIC_RESULT_BUSY;
 				result = MIC_RESULT_READY;
-				cb->attach_callback = NULL;
+				cb->cold->attach_callback = NULL;
 				*micblock = cb;
 			}
 			else
+			{
+				cb->stats.busy_rejections++;
 				result = MIC_RESULT_BUSY;
+			}
 		}
 		else
 			result = MIC_RESULT_INVALID_STATE;
@@ -632,49 +1539,210 @@ void __MICPutControlBlock(struct MICControlBlock *micblock, s32 result)
 	u32 level = IRQ_Disable();
 	
 	if (micblock->is_attached ||
-		(micblock->result_code == MIC_RESULT_BUSY))
+		(micblock->cold->result_code == MIC_RESULT_BUSY))
 	{
-		micblock->result_code = result;
+		micblock->cold->result_code = result;
 	}
 	
 	IRQ_Restore(level);
 }
 
-BOOL __MICUpdateStatus(s32 chan, u32 status, BOOL dunno)
+s32 __MICCanQueue(s32 chan, BOOL skip_active_check)
+{
+	s32 result = MIC_RESULT_NOCARD;
+	struct MICControlBlock *cb = &__MICBlock[chan];
+	struct MICColdBlock *cold = cb->cold;
+	
+	u32 level = IRQ_Disable();
+	
+	if (cb->is_attached)
+	{
+		BOOL active = cold->queue_count ? cold->queue_active : cb->is_active;
+		
+		if (!skip_active_check && active)
+			result = MIC_RESULT_INVALID_STATE;
+		else if (cold->queue_count == MIC_QUEUE_DEPTH ||
+			(cold->result_code == MIC_RESULT_BUSY && cold->queue_count == 0))
+		{
+			// Queue full, or a mount/unmount is in flight
+			cb->stats.busy_rejections++;
+			result = MIC_RESULT_BUSY;
+		}
+		else
+			result = MIC_RESULT_READY;
+	}
+	
+	IRQ_Restore(level);
+	return result;
+}
+
+s32 __MICQueueCommand(s32 chan, BOOL skip_active_check, u32 mask, u32 bits, u32 flags, MICCallback callback)
+{
+	s32 result;
+	struct MICControlBlock *cb = &__MICBlock[chan];
+	struct MICColdBlock *cold = cb->cold;
+	
+	u32 level = IRQ_Disable();
+	
+	if ((result = __MICCanQueue(chan, skip_active_check)) >= MIC_RESULT_READY)
+	{
+		if (cold->queue_count == 0)
+			cold->queue_active = cb->is_active;
+		
+		struct MICCommand *cmd = &cold->queue[(cold->queue_head + cold->queue_count) % MIC_QUEUE_DEPTH];
+		cmd->mask = mask;
+		cmd->bits = bits;
+		cmd->flags = flags;
+		cmd->result = MIC_RESULT_BUSY;
+		cmd->callback = callback;
+		cold->queue_count++;
+		cold->queue_serial++;
+		
+		if (flags & MIC_COMMAND_RESET)
+			cold->queue_active = FALSE;
+		else if (mask & MIC_STATUS_ACTIVE)
+			cold->queue_active = (bits & MIC_STATUS_ACTIVE) != 0;
+		
+		cold->result_code = MIC_RESULT_BUSY;
+		cb->set_callback = __MICSetCallback;
+	}
+	
+	IRQ_Restore(level);
+	return result;
+}
+
+void __MICCompleteCommands(s32 chan, s32 result)
 {
 	struct MICControlBlock *cb = &__MICBlock[chan];
+	struct MICColdBlock *cold = cb->cold;
 	
 	u32 level = IRQ_Disable();
 	
-	switch ((status >> 13) & 3)
+	// The status read or EXI_Lock failed; nothing queued can be applied
+	if (result < MIC_RESULT_READY)
+	{
+		for (; cold->queue_done < cold->queue_count; cold->queue_done++)
+			cold->queue[(cold->queue_head + cold->queue_done) % MIC_QUEUE_DEPTH].result = result;
+	}
+	
+	while (cold->queue_done)
+	{
+		struct MICCommand *cmd = &cold->queue[cold->queue_head];
+		MICCallback callback = cmd->callback;
+		result = cmd->result;
+		
+		cold->queue_head = (cold->queue_head + 1) % MIC_QUEUE_DEPTH;
+		cold->queue_count--;
+		cold->queue_done--;
+		__MICSyncDone(chan, result);
+		
+		// The callback may queue the next command
+		if (callback)
+		{
+			IRQ_Restore(level);
+			callback(chan, result);
+			level = IRQ_Disable();
+		}
+	}
+	
+	if (cold->queue_count == 0)
+	{
+		cb->set_callback = NULL;
+		__MICPutControlBlock(cb, result);
+	}
+	
+	IRQ_Restore(level);
+}
+
+void __MICFlushCommands(s32 chan, s32 result)
+{
+	struct MICControlBlock *cb = &__MICBlock[chan];
+	struct MICColdBlock *cold = cb->cold;
+	
+	cb->set_callback = NULL;
+	
+	while (cold->queue_count)
 	{
-	case 0:
-		cb->hw_buff_size = 32;
-		break;
-	case 1:
-		cb->hw_buff_size = 64;
-		break;
-	default:
-		cb->hw_buff_size = 128;
-		break;
+		MICCallback callback = cold->queue[cold->queue_head].callback;
+		
+		cold->queue_head = (cold->queue_head + 1) % MIC_QUEUE_DEPTH;
+		cold->queue_count--;
+		__MICSyncDone(chan, result);
+		
+		if (callback)
+			callback(chan, result);
 	}
 	
-	switch ((status >> 11) & 3)
+	cold->queue_done = 0;
+}
+
+void __MICPrepareStart(s32 chan, u32 status)
+{
+	struct MICControlBlock *cb = &__MICBlock[chan];
+	
+	u32 level = IRQ_Disable();
+	
+	cb->error_count = 0;
+	cb->buff_ring_cur = 0;
+	cb->buff_pos = 0;
+	cb->is_recovering = FALSE;
+	cb->cold->discont_count = 0;
+	__MICPublishCursor(chan, TRUE);
+	
+	if (__MICLink.is_linked)
 	{
-	case 0:
-		cb->sample_rate = 11025;
-		break;
-	case 1:
-		cb->sample_rate = 22050;
-		break;
-	default:
-		cb->sample_rate = 44100;
-		break;
+		__MICLink.is_aligned = FALSE;
+		__MICLink.read_pos = 0;
 	}
 	
-	cb->gain = (status & MIC_STATUS_GAIN15) ? 15 : 0;
+	cb->block_ticks = __MICStatusTable[MIC_STATUS_INDEX(status)].block_ticks;
+	__MICWatchdogReset(chan);
+	
+	// The ring is not cleared; buff_pos says how much of it is valid and
+	// MICGetSamples reads anything older as silence
+	
+	IRQ_Restore(level);
+}
+
+BOOL __MICUpdateStatus(s32 chan, u32 status, BOOL dunno)
+{
+	struct MICControlBlock *cb = &__MICBlock[chan];
+	const struct MICStatusInfo *info = &__MICStatusTable[MIC_STATUS_INDEX(status)];
+	
+	u32 level = IRQ_Disable();
+	const BOOL was_active = cb->is_active;
+	
+	cb->sample_rate = info->sample_rate;
+	cb->cold->gain = info->gain;
+	
+	// The old interval statistics mean nothing at a new block size or rate
+	if (cb->block_ticks != info->block_ticks)
+	{
+		cb->block_ticks = info->block_ticks;
+		__MICWatchdogReset(chan);
+	}
 	
-	cb->buff_ring_size = cb->hw_buff_size * (cb->buff_size / cb->hw_buff_size);
+	// The ring is sized again only for a new block size; mounting clears
+	// hw_buff_size, and MICSetGuard and the ring swap size it themselves
+	if (cb->hw_buff_size != info->hw_buff_size)
+	{
+		cb->hw_buff_size = info->hw_buff_size;
+		
+		u32 guard_size;
+		const u32 ring_size = __MICRingSize(chan, cb->cold->buff_size, &guard_size);
+		if (ring_size != cb->buff_ring_size)
+		{
+			cb->buff_ring_size = ring_size;
+			cb->buff_guard_size = guard_size;
+			__MICMirror(chan, 0, cb->buff_guard_size);
+			__MICPublishCursor(chan, TRUE);
+		}
+		else if (guard_size != cb->buff_guard_size)
+		{
+			cb->buff_guard_size = guard_size;
+			__MICMirror(chan, 0, cb->buff_guard_size);
+		}
+	}
 	
 	if (status & MIC_STATUS_ACTIVE)
 	{
@@ -689,80 +1757,493 @@ BOOL __MICUpdateStatus(s32 chan, u32 status, BOOL dunno)
 	
 	if (dunno && ((cb->last_status ^ status) & 0xfc0f)) // checks all bits except buff_ovrflw and buttons
 	{
+		MIC_EVENT(chan, MIC_EVENT_STATUS_RESET, status);
 		cb->is_active = FALSE;
 		__MICRawReset(chan);
 		__MICRawReadStatus(chan, &status);
 		__MICUpdateStatus(chan, status, FALSE);
+		if (was_active)
+			__MICNotifyListeners(chan, MIC_RESULT_INVALID_STATE);
 		IRQ_Restore(level);
 		return FALSE;
 	}
 	else
 	{
 		cb->last_status = status;
+		if (was_active && !cb->is_active)
+			__MICNotifyListeners(chan, MIC_RESULT_INVALID_STATE);
 		IRQ_Restore(level);
 		return TRUE;
 	}
 }
 
+s32 __MICFindStatus(u32 status, s32 size, s32 rate, s32 gain)
+{
+	const struct MICStatusInfo *cur = &__MICStatusTable[MIC_STATUS_INDEX(status)];
+	
+	if (size == MIC_PARAM_KEEP)
+		size = cur->hw_buff_size;
+	if (rate == MIC_PARAM_KEEP)
+		rate = cur->sample_rate;
+	if (gain == MIC_PARAM_KEEP)
+		gain = cur->gain;
+	
+	s32 index;
+	for (index = 0; index < 32; index++)
+	{
+		const struct MICStatusInfo *info = &__MICStatusTable[index];
+		if (info->hw_buff_size == size &&
+			info->sample_rate == rate &&
+			info->gain == gain)
+			return index;
+	}
+	
+	return -1;
+}
+
+u32 __MICEncodeStatus(u32 status, s32 index)
+{
+	return (status & ~MIC_STATUS_PARAMS) | (index << MIC_STATUS_PARAMS_SHIFT);
+}
+
 void __MICUpdateButton(s32 chan)
 {
 	struct MICControlBlock *cb = &__MICBlock[chan];
 	u32 level = IRQ_Disable();
 	
 	u32 ticks = gettick();
-	u32 delta = (ticks - cb->button_time_last) + cb->button_time_delta;
+	u32 delta = (ticks - cb->cold->button_time_last) + cb->cold->button_time_delta;
 	
 	if (delta >= 10000)
 	{
 		u32 button_bits = (cb->last_status >> 4) & 0x1f;
 		button_bits &= ~1; // Mask off the "DeviceID" bit (always 0)
 		
-		u32 button_changed = cb->button ^ cb->last_button;
-		u32 new_button = (button_bits & ~button_changed) | (cb->button & button_changed);
+		u32 button_changed = cb->cold->button ^ cb->cold->last_button;
+		u32 new_button = (button_bits & ~button_changed) | (cb->cold->button & button_changed);
 		
-		cb->button = new_button;
-		cb->last_button = button_bits;
+		cb->cold->button = new_button;
+		cb->cold->last_button = button_bits;
 		
 		delta = 0;
 	}
 	
-	cb->button_time_last = ticks;
-	cb->button_time_delta = delta;
+	cb->cold->button_time_last = ticks;
+	cb->cold->button_time_delta = delta;
 	
 	IRQ_Restore(level);
 }
 
-void MICInit(void)
+void __MICIrqStat(s32 chan, u32 start)
 {
-	if (__init == FALSE)
+	struct MICControlBlock *cb = &__MICBlock[chan];
+	u32 ticks = gettick() - start;
+	
+	if (ticks > cb->stats.irq_disabled_max)
+		cb->stats.irq_disabled_max = ticks;
+	cb->irq_disabled_total += ticks;
+	cb->irq_disabled_count++;
+}
+
+// Publish the ring top, and on reconfiguration a new generation, for the
+// readers that skip IRQ_Disable. Runs in interrupt context or with
+// interrupts off wherever the ring, its cursor or the attach state change.
+void __MICPublishCursor(s32 chan, BOOL reconfigured)
+{
+	struct MICControlBlock *cb = &__MICBlock[chan];
+	const u32 samples = cb->buff_ring_size / sizeof(s16);
+	const u64 written = cb->buff_pos / sizeof(s16);
+	u32 gen = cb->cursor >> MIC_CURSOR_INDEX_BITS;
+	u32 index = MIC_CURSOR_DETACHED;
+	
+	if (reconfigured)
+		gen++;
+	
+	// Rings too large to index in the cursor word stay on the locked paths
+	if (cb->is_attached && samples < MIC_CURSOR_DETACHED)
+		index = cb->buff_ring_cur / sizeof(s16);
+	
+	cb->cursor_samples = samples;
+	cb->cursor_filled = (written < samples) ? (u32)written : samples;
+	cb->cursor_written = (u32)written;
+	cb->cursor = (gen << MIC_CURSOR_INDEX_BITS) | index;
+}
+
+// Snapshot of the published cursor without IRQ_Disable. FALSE if the
+// channel is detached, or a block landed or the ring was reconfigured while
+// reading; the caller then takes the locked path.
+BOOL __MICReadCursor(s32 chan, u32 *top, u32 *samples, u32 *filled, s16 **base, u32 *written)
+{
+	struct MICControlBlock *cb = &__MICBlock[chan];
+	const u32 cursor = cb->cursor;
+	
+	__MICBarrier();
+	*samples = cb->cursor_samples;
+	*filled = cb->cursor_filled;
+	if (base)
+		*base = cb->buff_ring_base;
+	if (written)
+		*written = cb->cursor_written;
+	__MICBarrier();
+	
+	if (cb->cursor != cursor || (cursor & MIC_CURSOR_INDEX_MASK) == MIC_CURSOR_DETACHED)
+		return FALSE;
+	
+	*top = cursor & MIC_CURSOR_INDEX_MASK;
+	return TRUE;
+}
+
+// Record a read from index up to end (unwrapped, as __MICCopySamples
+// returns it) against a snapshot of the ring. Readers are told apart by
+// where their last read ended, so a caller coming back to an index the
+// producer has since lapped counts one ring overrun. Readers that work on
+// the ring in place are never seen. Also runs without IRQ_Disable, from
+// the lock-free path; a reader preempted here by another can at worst lose
+// its slot.
+void __MICNoteRead(s32 chan, u32 gen, s32 top, s32 samples_in_ring, u32 written, s32 index, s32 end)
+{
+	struct MICControlBlock *cb = &__MICBlock[chan];
+	struct MICReader *slot = NULL;
+	u32 i;
+	
+	for (i = 0; i < MIC_READERS; i++)
 	{
-		int i;
-		for (i = 0; i < 2; i++)
+		struct MICReader *r = &cb->cold->readers[i];
+		
+		if (r->gen == gen && r->index == index)
 		{
-			__MICBlock[i].result_code = MIC_RESULT_NOCARD;
-			__MICBlock[i].is_attached = FALSE;
-			__MICBlock[i].is_active = FALSE;
-			__MICBlock[i].exi_callback = NULL;
-			__MICBlock[i].tx_callback = NULL;
-			__MICBlock[i].detach_callback = NULL;
-			__MICBlock[i].attach_callback = NULL;
-			__MICBlock[i].mount_callback = NULL;
-			__MICBlock[i].set_callback = NULL;
-			__MICBlock[i].error_count = 0;
-			LWP_InitQueue(&__MICBlock[i].thread_queue);
+			if (written - r->pos > (u32)samples_in_ring)
+			{
+				u32 level = IRQ_Disable();
+				cb->stats.ring_overruns++;
+				MIC_EVENT(chan, MIC_EVENT_OVERRUN, MIC_EVENT_BLOCK(cb));
+				IRQ_Restore(level);
+			}
+			slot = r;
+			break;
 		}
 		
-		SYS_CreateAlarm(&__alarm);
-		
-		struct timespec period;
-		period.tv_sec = 0;
-		period.tv_nsec = 5 * TB_NSPERMS;
-		SYS_SetPeriodicAlarm(__alarm, &period, &period, __MICAlarmCallback, NULL);
-		
-		SYS_CreateAlarm(&__timeout[0]);
-		SYS_CreateAlarm(&__timeout[1]);
-		
-		__init = TRUE;
+		// A new reader takes an unused slot, or else the one furthest behind
+		if (slot == NULL || (slot->gen == gen && slot->index >= 0 &&
+			(r->gen != gen || r->index < 0 || written - r->pos > written - slot->pos)))
+			slot = r;
+	}
+	
+	end %= samples_in_ring;
+	s32 left = top - end;
+	if (left < 0)
+		left += samples_in_ring;
+	
+	slot->gen = gen;
+	slot->pos = written - left;
+	slot->index = end;
+}
+
+// How far behind the top the slowest reader seen by __MICNoteRead is, not
+// counting any the producer has lapped, or the whole ring if none has read
+// since it was last reconfigured. Called with interrupts off.
+u32 __MICReaderLag(s32 chan)
+{
+	struct MICControlBlock *cb = &__MICBlock[chan];
+	const u32 gen = cb->cursor >> MIC_CURSOR_INDEX_BITS;
+	const u32 written = (u32)(cb->buff_pos / sizeof(s16));
+	const u32 samples_in_ring = cb->buff_ring_size / sizeof(s16);
+	BOOL seen = FALSE;
+	u32 lag = 0;
+	u32 i;
+	
+	for (i = 0; i < MIC_READERS; i++)
+	{
+		const struct MICReader *r = &cb->cold->readers[i];
+		if (r->gen == gen && r->index >= 0)
+		{
+			const u32 behind = written - r->pos;
+			seen = TRUE;
+			if (behind <= samples_in_ring && behind > lag)
+				lag = behind;
+		}
+	}
+	
+	return seen ? lag : samples_in_ring;
+}
+
+// Called in interrupt context or with interrupts off
+void __MICNotifyListeners(s32 chan, s32 result)
+{
+	struct MICControlBlock *cb = &__MICBlock[chan];
+	
+	u32 i;
+	for (i = 0; i < cb->tx_listener_count; i++)
+		cb->cold->tx_listeners[i](chan, result);
+}
+
+#ifdef MIC_EVENTLOG
+void __MICLogEvent(s32 chan, u32 type, u32 arg)
+{
+	MICEvent *event = &__MICEventLog[__MICEventHead++ & (MIC_EVENTLOG_SIZE - 1)];
+	event->tick = gettick();
+	event->chan = chan;
+	event->type = type;
+	event->arg = arg;
+}
+#endif
+
+#ifdef MIC_PROFILE
+void __MICProfileReset(s32 chan)
+{
+	struct MICColdBlock *cold = &__MICCold[chan];
+	
+	memset(&cold->profile, 0, sizeof(MICProfile));
+	memset(cold->profile_end, 0, sizeof(cold->profile_end));
+	cold->profile_head = 0;
+	cold->profile_start = gettime();
+}
+
+void __MICProfileHandler(s32 chan, u32 start)
+{
+	MICProfile *profile = &__MICCold[chan].profile;
+	u32 ticks = gettick() - start;
+	
+	if (ticks > profile->handler_max)
+		profile->handler_max = ticks;
+	profile->handler_total += ticks;
+	profile->handler_count++;
+}
+
+void __MICProfileBlock(s32 chan, u32 tick)
+{
+	struct MICControlBlock *cb = &__MICBlock[chan];
+	struct MICColdBlock *cold = cb->cold;
+	
+	cold->profile_end[cold->profile_head] = (u32)(cb->buff_pos / sizeof(s16));
+	cold->profile_tick[cold->profile_head] = tick;
+	cold->profile_head = (cold->profile_head + 1) % MIC_PROFILE_RECORDS;
+}
+
+// Called with interrupts off by MICGetSamples, which handed out samples
+// starting at ring index
+void __MICProfileRead(s32 chan, u32 index)
+{
+	struct MICControlBlock *cb = &__MICBlock[chan];
+	struct MICColdBlock *cold = cb->cold;
+	const u32 samples_in_ring = cb->buff_ring_size / sizeof(s16);
+	const u32 block = cb->hw_buff_size / sizeof(s16);
+	const u32 top = cb->buff_ring_cur / sizeof(s16);
+	
+	if (cb->buff_pos == 0 || block == 0)
+		return;
+	
+	// Stream position of the sample and of the end of its block
+	u32 behind = (top + samples_in_ring - index) % samples_in_ring;
+	if (behind == 0)
+		behind = samples_in_ring;
+	if ((u64)behind > cb->buff_pos / sizeof(s16))
+		return;
+	const u32 pos = (u32)(cb->buff_pos / sizeof(s16)) - behind;
+	const u32 end = pos - pos % block + block;
+	
+	// Newest record first; past the oldest, step back a block interval at a time
+	u32 i;
+	u32 tick = 0;
+	BOOL found = FALSE;
+	s32 oldest = -1;
+	for (i = 1; i <= MIC_PROFILE_RECORDS; i++)
+	{
+		u32 r = (cold->profile_head + MIC_PROFILE_RECORDS - i) % MIC_PROFILE_RECORDS;
+		if (cold->profile_end[r] == 0)
+			break;
+		if (cold->profile_end[r] == end)
+		{
+			tick = cold->profile_tick[r];
+			found = TRUE;
+			break;
+		}
+		oldest = r;
+	}
+	
+	if (!found)
+	{
+		// Nothing recorded since MICResetStats yet
+		if (oldest < 0)
+			return;
+		
+		u32 interval = cb->interval_avg ? cb->interval_avg : cb->block_ticks;
+		tick = cold->profile_tick[oldest] - (cold->profile_end[oldest] - end) / block * interval;
+	}
+	
+	const u32 us = (u32)ticks_to_microsecs(gettick() - tick);
+	MICProfile *profile = &cold->profile;
+	
+	u32 bucket = us;
+	if (us >= 4)
+	{
+		u32 n = 31 - __builtin_clz(us);
+		bucket = 4 * (n - 1) + ((us >> (n - 2)) & 3);
+	}
+	if (bucket >= MIC_LATENCY_BUCKETS)
+		bucket = MIC_LATENCY_BUCKETS - 1;
+	
+	profile->latency[bucket]++;
+	profile->reads++;
+	profile->latency_total += us;
+	if (us > profile->latency_max)
+		profile->latency_max = us;
+}
+#endif
+
+void __MICTraceWrite(s32 chan, u32 op, s32 result, u32 value, const void *payload)
+{
+	struct MICControlBlock *cb = &__MICBlock[chan];
+	
+	if (cb->trace_cur == NULL || cb->trace_replay)
+		return;
+	
+	u32 len = sizeof(MICTraceEntry) + (payload ? value : 0);
+	u32 level = IRQ_Disable();
+	
+	if (cb->trace_cur && cb->trace_cur + len <= cb->cold->trace_end)
+	{
+		MICTraceEntry *entry = (MICTraceEntry*)cb->trace_cur;
+		entry->tick = gettick();
+		entry->op = op;
+		entry->result = result;
+		entry->value = value;
+		if (payload)
+			memcpy(entry + 1, payload, value);
+		cb->trace_cur += len;
+	}
+	
+	IRQ_Restore(level);
+}
+
+MICTraceEntry* __MICReplayNext(s32 chan, u32 op)
+{
+	struct MICControlBlock *cb = &__MICBlock[chan];
+	
+	while (cb->trace_cur + sizeof(MICTraceEntry) <= cb->cold->trace_end)
+	{
+		MICTraceEntry *entry = (MICTraceEntry*)cb->trace_cur;
+		
+		if (entry->op == op)
+		{
+			cb->trace_cur += sizeof(MICTraceEntry);
+			return entry;
+		}
+		
+		cb->cold->trace_mismatch++;
+		
+		// Never swallow the next interrupt or a payload; the replay loop
+		// dispatches those
+		if (entry->op <= MIC_TRACE_TIMEOUT || entry->op == MIC_TRACE_DMA_DONE)
+			break;
+		
+		cb->trace_cur += sizeof(MICTraceEntry);
+	}
+	
+	return NULL;
+}
+
+// EXI bus calls made from the interrupt paths. A replayed channel has no
+// device behind it, so these succeed without touching the bus and the
+// handlers go on to consume the trace records that follow.
+BOOL __MICExiLock(s32 chan)
+{
+	if (__MICBlock[chan].trace_replay)
+		return TRUE;
+	
+	return EXI_Lock(chan, EXI_DEVICE_0, NULL) != 0;
+}
+
+void __MICExiUnlock(s32 chan)
+{
+	if (!__MICBlock[chan].trace_replay)
+		EXI_Unlock(chan);
+}
+
+BOOL __MICExiDeselect(s32 chan)
+{
+	if (__MICBlock[chan].trace_replay)
+		return TRUE;
+	
+	return EXI_Deselect(chan) != 0;
+}
+
+BOOL __MICExiProbe(s32 chan)
+{
+	if (__MICBlock[chan].trace_replay)
+		return TRUE;
+	
+	return EXI_Probe(chan) != 0;
+}
+
+void MICInit(void)
+{
+	if (__init == FALSE)
+	{
+		int i, j;
+		for (i = 0; i < 2; i++)
+		{
+			__MICCold[i].result_code = MIC_RESULT_NOCARD;
+			__MICBlock[i].is_attached = FALSE;
+			__MICBlock[i].is_active = FALSE;
+			__MICBlock[i].cursor = MIC_CURSOR_DETACHED;
+			__MICBlock[i].cursor_samples = 0;
+			__MICBlock[i].cursor_filled = 0;
+			__MICBlock[i].exi_callback = NULL;
+			__MICBlock[i].tx_callback = NULL;
+			__MICBlock[i].tx_listener_count = 0;
+			__MICCold[i].detach_callback = NULL;
+			__MICCold[i].attach_callback = NULL;
+			__MICCold[i].mount_callback = NULL;
+			__MICCold[i].queue_head = 0;
+			__MICCold[i].queue_count = 0;
+			__MICCold[i].queue_serial = 0;
+			__MICCold[i].done_serial = 0;
+			__MICCold[i].sync_waiters = NULL;
+			__MICCold[i].queue_done = 0;
+			__MICCold[i].auto_resume = FALSE;
+			__MICCold[i].resume_pending = FALSE;
+			__MICCold[i].resume_gap = 0;
+			__MICCold[i].resume_callback = NULL;
+			__MICCold[i].auto_recover = FALSE;
+			__MICCold[i].gap_fill = FALSE;
+			__MICCold[i].guard_size = 0;
+			__MICBlock[i].buff_guard_size = 0;
+			__MICCold[i].discont_head = 0;
+			__MICCold[i].discont_count = 0;
+			__MICBlock[i].is_recovering = FALSE;
+			__MICBlock[i].swap_base = NULL;
+			__MICBlock[i].block_ticks = 0;
+			__MICBlock[i].interval_avg = 0;
+			__MICBlock[i].interval_dev = 0;
+			__MICBlock[i].watchdog_ticks = 0;
+			__MICBlock[i].set_callback = NULL;
+			__MICBlock[i].error_count = 0;
+			memset(&__MICBlock[i].stats, 0, sizeof(MICStats));
+			for (j = 0; j < MIC_READERS; j++)
+				__MICCold[i].readers[j].index = -1;
+			__MICBlock[i].irq_disabled_total = 0;
+			__MICBlock[i].irq_disabled_count = 0;
+			__MICBlock[i].cold = &__MICCold[i];
+			__MICBlock[i].trace_cur = NULL;
+			__MICBlock[i].trace_replay = FALSE;
+#ifdef MIC_PROFILE
+			__MICProfileReset(i);
+#endif
+			LWP_InitQueue(&__MICCold[i].thread_queue);
+		}
+		
+		SYS_CreateAlarm(&__alarm);
+		
+		struct timespec period;
+		period.tv_sec = 0;
+		period.tv_nsec = 5 * TB_NSPERMS;
+		SYS_SetPeriodicAlarm(__alarm, &period, &period, __MICAlarmCallback, NULL);
+		
+		SYS_CreateAlarm(&__timeout[0]);
+		SYS_CreateAlarm(&__timeout[1]);
+		
+		__init = TRUE;
 	}
 }
 
@@ -829,7 +2310,7 @@ s32 MICGetResultCode(s32 chan)
 	if (__init &&
 		chan >= 0 && chan <= 1)
 	{
-		result = __MICBlock[chan].result_code;
+		result = __MICCold[chan].result_code;
 	}
 	
 	return result;
@@ -848,6 +2329,55 @@ u32 MICGetErrorCount(s32 chan)
 	return result;
 }
 
+s32 MICGetStats(s32 chan, MICStats* stats)
+{
+	s32 result = MIC_RESULT_FATAL_ERROR;
+	
+	if (__init &&
+		chan >= 0 && chan <= 1 &&
+		stats != NULL)
+	{
+		struct MICControlBlock *cb = &__MICBlock[chan];
+		u32 level = IRQ_Disable();
+		
+		*stats = cb->stats;
+		stats->irq_disabled_avg = cb->irq_disabled_count ?
+			(u32)(cb->irq_disabled_total / cb->irq_disabled_count) : 0;
+		stats->block_interval = cb->interval_avg;
+		stats->block_jitter = cb->interval_dev;
+		stats->watchdog_timeout = cb->watchdog_ticks;
+		
+		IRQ_Restore(level);
+		result = MIC_RESULT_READY;
+	}
+	
+	return result;
+}
+
+s32 MICResetStats(s32 chan)
+{
+	s32 result = MIC_RESULT_FATAL_ERROR;
+	
+	if (__init &&
+		chan >= 0 && chan <= 1)
+	{
+		struct MICControlBlock *cb = &__MICBlock[chan];
+		u32 level = IRQ_Disable();
+		
+		memset(&cb->stats, 0, sizeof(cb->stats));
+		cb->irq_disabled_total = 0;
+		cb->irq_disabled_count = 0;
+#ifdef MIC_PROFILE
+		__MICProfileReset(chan);
+#endif
+		
+		IRQ_Restore(level);
+		result = MIC_RESULT_READY;
+	}
+	
+	return result;
+}
+
 
 s32 MICMountAsync(s32 chan, s16* buffer, s32 size, MICCallback detachCallback, MICCallback attachCallback)
 {
@@ -859,8 +2389,9 @@ s32 MICMountAsync(s32 chan, s16* buffer, s32 size, MICCallback detachCallback, M
 		struct MICControlBlock *cb = &__MICBlock[chan];
 		u32 level = IRQ_Disable();
 		
-		if (cb->result_code == MIC_RESULT_BUSY)
+		if (cb->cold->result_code == MIC_RESULT_BUSY)
 		{
+			cb->stats.busy_rejections++;
 			IRQ_Restore(level);
 			return MIC_RESULT_BUSY;
 		}
@@ -871,26 +2402,34 @@ s32 MICMountAsync(s32 chan, s16* buffer, s32 size, MICCallback detachCallback, M
 			{
 				if (cb->is_attached || EXI_Attach(chan, __MICExtHandler))
 				{
-					cb->result_code = MIC_RESULT_BUSY;
+					cb->cold->result_code = MIC_RESULT_BUSY;
 					cb->is_active = FALSE;
 					cb->exi_callback = NULL;
 					cb->tx_callback = NULL;
-					cb->detach_callback = detachCallback;
-					cb->attach_callback = attachCallback;
-					cb->mount_callback = NULL;
+					cb->cold->detach_callback = detachCallback;
+					cb->cold->attach_callback = attachCallback;
+					cb->cold->mount_callback = NULL;
+					cb->cold->resume_pending = FALSE;
+					cb->swap_base = NULL;
+					cb->cold->queue_count = 0;
+					cb->cold->done_serial = cb->cold->queue_serial;
+					cb->cold->queue_done = 0;
 					cb->set_callback = NULL;
 					cb->buff_ring_base = (s16*)(((u32)buffer + 31) & ~31);
-					cb->buff_size = size - (cb->buff_ring_base - buffer);
+					cb->cold->buff_size = size - (cb->buff_ring_base - buffer);
+					cb->buff_ring_size = 0;
 					cb->buff_ring_cur = 0;
+					cb->hw_buff_size = 0;
+					__MICPublishCursor(chan, TRUE);
 
 					EXI_RegisterEXICallback(chan, NULL);
 					IRQ_Restore(level);
 
-					cb->mount_callback = __MICMountCallback;
+					cb->cold->mount_callback = __MICMountCallback;
 
 					if (EXI_Lock(chan, EXI_DEVICE_0, __MICUnlockedCallback))
 					{
-						cb->mount_callback = NULL;
+						cb->cold->mount_callback = NULL;
 						return __MICDoMount(chan);
 					}
 
@@ -905,7 +2444,7 @@ s32 MICMountAsync(s32 chan, s16* buffer, s32 size, MICCallback detachCallback, M
 		else
 			result = MIC_RESULT_INVALID_STATE;
 		
-		cb->result_code = result;
+		cb->cold->result_code = result;
 		IRQ_Restore(level);
 	}
 	
@@ -929,6 +2468,21 @@ s32 MICUnmount(s32 chan)
 		chan >= 0 && chan <= 1)
 	{
 		struct MICControlBlock *cb = NULL;
+		struct MICColdBlock *cold = &__MICCold[chan];
+		
+		// A hot-unplugged channel waiting to auto-resume is already detached
+		// but still owns the ring. Cancel the resume so it can't restart DMA
+		// into a buffer the caller frees after this.
+		u32 level = IRQ_Disable();
+		if (!__MICBlock[chan].is_attached && cold->resume_pending)
+		{
+			cold->resume_pending = FALSE;
+			cold->detach_callback = NULL;
+			IRQ_Restore(level);
+			return MIC_RESULT_READY;
+		}
+		IRQ_Restore(level);
+		
 		if ((result = __MICGetControlBlock(chan, FALSE, &cb)) >= MIC_RESULT_READY)
 		{
 			__MICDoUnmount(chan, MIC_RESULT_NOCARD);
@@ -965,167 +2519,181 @@ s32 MICGetRingbuffsize(s32 chan, s32* size)
 	return result;
 }
 
-
-s32 MICSetStatusAsync(s32 chan, u32 status, MICCallback setCallback)
+s32 MICGetRingbuff(s32 chan, s16** buffer)
 {
 	s32 result = MIC_RESULT_FATAL_ERROR;
 	
-	if (__init &&
-		chan >= 0 && chan <= 1)
+	if (__init == TRUE &&
+		chan >= 0 && chan <= 1 &&
+		buffer != NULL)
 	{
+		struct MICControlBlock *cb = &__MICBlock[chan];
+		
 		u32 level = IRQ_Disable();
 		
-		struct MICControlBlock *cb = NULL;
-		if ((result = __MICGetControlBlock(chan, FALSE, &cb)) >= MIC_RESULT_READY)
+		if (cb->is_attached)
 		{
-			cb->status = status;
-			cb->attach_callback = setCallback;
-			cb->set_callback = __MICSetCallback;
+			*buffer = cb->buff_ring_base;
 			result = MIC_RESULT_READY;
 		}
-		
+		else
+			result = MIC_RESULT_NOCARD;
+			
 		IRQ_Restore(level);
 	}
 	
 	return result;
 }
 
-s32 MICSetStatus(s32 chan, u32 status)
-{
-	s32 result = MICSetStatusAsync(chan, status, __MICSyncCallback);
-	if (result >= MIC_RESULT_READY)
-		return __MICSync(chan);
-	else
-		return result;
-}
-
-s32 MICGetStatus(s32 chan, u32* status)
+s32 MICSwapRingBuffer(s32 chan, s16* buffer, s32 size)
 {
 	s32 result = MIC_RESULT_FATAL_ERROR;
 	
 	if (__init &&
 		chan >= 0 && chan <= 1 &&
-		status != NULL)
+		buffer != NULL &&
+		size > 0)
 	{
 		struct MICControlBlock *cb = &__MICBlock[chan];
+		s16 *base = (s16*)(((u32)buffer + 31) & ~31);
+		s32 usable = size - ((u8*)base - (u8*)buffer);
+		
+		// The ring has to hold at least the largest hw block
+		if (usable < 128)
+			return MIC_RESULT_INVALID_STATE;
+		
+		// Samples the driver can't migrate read as silence, as after MICStart
+		memset(base, 0, usable);
+		
 		u32 level = IRQ_Disable();
-		if (cb->is_attached)
+		
+		if (!cb->is_attached)
+			result = MIC_RESULT_NOCARD;
+		else if (cb->hw_buff_size == 0)
+			result = MIC_RESULT_INVALID_STATE;
+		else if (cb->swap_base)
 		{
-			*status = cb->last_status;
-			result = MIC_RESULT_READY;
+			cb->stats.busy_rejections++;
+			result = MIC_RESULT_BUSY;
 		}
 		else
-			result = MIC_RESULT_NOCARD;
+		{
+			cb->swap_base = base;
+			cb->cold->swap_size = usable;
+			
+			// With no DMA to wait for, swap now
+			if (!cb->is_active)
+				__MICSwapRing(chan);
+			
+			result = MIC_RESULT_READY;
+		}
+		
 		IRQ_Restore(level);
 	}
 	
 	return result;
 }
 
-
-s32 MICSetParamsAsync(s32 chan, s32 size, s32 rate, s32 gain, MICCallback setCallback)
+s32 MICSetAutoResume(s32 chan, BOOL enable, MICCallback resumeCallback)
 {
 	s32 result = MIC_RESULT_FATAL_ERROR;
 	
 	if (__init &&
-		chan >= 0 && chan <= 1 &&
-		(size == 32 || size == 64 || size == 128) &&
-		(rate == 11025 || rate == 22050 || rate == 44100) &&
-		(gain == 0 || gain == 15))
+		chan >= 0 && chan <= 1)
 	{
+		struct MICColdBlock *cold = &__MICCold[chan];
 		u32 level = IRQ_Disable();
 		
-		struct MICControlBlock *cb = NULL;
-		if ((result = __MICGetControlBlock(chan, FALSE, &cb)) >= MIC_RESULT_READY)
+		cold->auto_resume = enable;
+		cold->resume_callback = enable ? resumeCallback : NULL;
+		if (!enable && cold->resume_pending)
 		{
-			u32 status = cb->last_status;
-			
-			status &= ~(MIC_STATUS_64BYTES | MIC_STATUS_128BYTES);
-			if (size == 64)
-				status |= MIC_STATUS_64BYTES;
-			else if (size == 128)
-				status |= MIC_STATUS_128BYTES;
-			
-			status &= ~(MIC_STATUS_22050Hz | MIC_STATUS_44100Hz);
-			if (rate == 22050)
-				status |= MIC_STATUS_22050Hz;
-			else if (rate == 44100)
-				status |= MIC_STATUS_44100Hz;
-			
-			status &= ~MIC_STATUS_GAIN15;
-			if (gain == 15)
-				status |= MIC_STATUS_GAIN15;
-			
-			cb->status = status;
-			
-			cb->attach_callback = setCallback;
-			cb->set_callback = __MICSetCallback;
-			result = MIC_RESULT_READY;
+			cold->resume_pending = FALSE;
+			cold->detach_callback = NULL;
 		}
 		
 		IRQ_Restore(level);
+		result = MIC_RESULT_READY;
 	}
 	
 	return result;
 }
 
-s32 MICSetParams(s32 chan, s32 size, s32 rate, s32 gain)
+s32 MICGetResumeGap(s32 chan, u32* samples)
 {
-	s32 result = MICSetParamsAsync(chan, size, rate, gain, __MICSyncCallback);
-	if (result >= MIC_RESULT_READY)
-		return __MICSync(chan);
-	else
-		return result;
+	s32 result = MIC_RESULT_FATAL_ERROR;
+	
+	if (__init &&
+		chan >= 0 && chan <= 1 &&
+		samples != NULL)
+	{
+		*samples = __MICCold[chan].resume_gap;
+		result = MIC_RESULT_READY;
+	}
+	
+	return result;
 }
 
-s32 MICGetParams(s32 chan, s32* size, s32* rate, s32* gain)
+s32 MICSetAutoRecover(s32 chan, BOOL enable)
 {
 	s32 result = MIC_RESULT_FATAL_ERROR;
 	
 	if (__init &&
-		chan >= 0 && chan <= 1 &&
-		size != NULL &&
-		rate != NULL &&
-		gain != NULL)
+		chan >= 0 && chan <= 1)
 	{
-		struct MICControlBlock *cb = &__MICBlock[chan];
-		u32 level = IRQ_Disable();
-		if (cb->is_attached)
-		{
-			*size = cb->hw_buff_size;
-			*rate = cb->sample_rate;
-			*gain = cb->gain;
-			result = MIC_RESULT_READY;
-		}
-		else
-			result = MIC_RESULT_NOCARD;
-		IRQ_Restore(level);
+		__MICCold[chan].auto_recover = enable;
+		result = MIC_RESULT_READY;
 	}
 	
 	return result;
 }
 
-
-s32 MICSetBuffsizeAsync(s32 chan, s32 size, MICCallback setCallback)
+s32 MICSetGapFill(s32 chan, BOOL enable)
 {
 	s32 result = MIC_RESULT_FATAL_ERROR;
 	
 	if (__init &&
-		chan >= 0 && chan <= 1 &&
-		(size == 32 || size == 64 || size == 128))
+		chan >= 0 && chan <= 1)
+	{
+		__MICCold[chan].gap_fill = enable;
+		result = MIC_RESULT_READY;
+	}
+	
+	return result;
+}
+
+s32 MICSetGuard(s32 chan, u32 bytes)
+{
+	s32 result = MIC_RESULT_FATAL_ERROR;
+	
+	if (__init &&
+		chan >= 0 && chan <= 1)
 	{
+		struct MICControlBlock *cb = &__MICBlock[chan];
 		u32 level = IRQ_Disable();
 		
-		struct MICControlBlock *cb = NULL;
-		if ((result = __MICGetControlBlock(chan, FALSE, &cb)) >= MIC_RESULT_READY)
+		// Resizing the ring under a running stream would move the indices
+		// readers hold
+		if (cb->is_active || cb->swap_base)
+			result = MIC_RESULT_INVALID_STATE;
+		else
 		{
-			cb->status = cb->last_status & ~(MIC_STATUS_64BYTES | MIC_STATUS_128BYTES);
-			if (size == 64)
-				cb->status |= MIC_STATUS_64BYTES;
-			else if (size == 128)
-				cb->status |= MIC_STATUS_128BYTES;
-			cb->attach_callback = setCallback;
-			cb->set_callback = __MICSetCallback;
+			cb->cold->guard_size = (bytes + sizeof(s16) - 1) & ~(sizeof(s16) - 1);
+			
+			if (cb->is_attached)
+			{
+				u32 guard_size;
+				const u32 ring_size = __MICRingSize(chan, cb->cold->buff_size, &guard_size);
+				cb->buff_guard_size = guard_size;
+				if (ring_size != cb->buff_ring_size)
+				{
+					cb->buff_ring_size = ring_size;
+					cb->buff_ring_cur = 0;
+					__MICPublishCursor(chan, TRUE);
+				}
+				__MICMirror(chan, 0, cb->buff_guard_size);
+			}
+			
 			result = MIC_RESULT_READY;
 		}
 		
@@ -1135,28 +2703,149 @@ s32 MICSetBuffsizeAsync(s32 chan, s32 size, MICCallback setCallback)
 	return result;
 }
 
-s32 MICSetBuffsize(s32 chan, s32 size)
+s32 MICGetGuard(s32 chan, u32* bytes)
 {
-	s32 result = MICSetBuffsizeAsync(chan, size, __MICSyncCallback);
+	s32 result = MIC_RESULT_FATAL_ERROR;
+	
+	if (__init &&
+		chan >= 0 && chan <= 1 &&
+		bytes != NULL)
+	{
+		struct MICControlBlock *cb = &__MICBlock[chan];
+		u32 level = IRQ_Disable();
+		
+		if (cb->is_attached)
+		{
+			*bytes = cb->buff_guard_size;
+			result = MIC_RESULT_READY;
+		}
+		else
+			result = MIC_RESULT_NOCARD;
+		
+		IRQ_Restore(level);
+	}
+	
+	return result;
+}
+
+s32 MICGetDiscontinuity(s32 chan, MICDiscontinuity* discont)
+{
+	s32 result = MIC_RESULT_FATAL_ERROR;
+	
+	if (__init &&
+		chan >= 0 && chan <= 1 &&
+		discont != NULL)
+	{
+		struct MICColdBlock *cold = &__MICCold[chan];
+		u32 level = IRQ_Disable();
+		
+		if (cold->discont_count)
+		{
+			*discont = cold->discont[cold->discont_head];
+			cold->discont_head = (cold->discont_head + 1) % MIC_DISCONT_DEPTH;
+			cold->discont_count--;
+			result = 1;
+		}
+		else
+			result = 0;
+		
+		IRQ_Restore(level);
+	}
+	
+	return result;
+}
+
+
+s32 MICSetStatusAsync(s32 chan, u32 status, MICCallback setCallback)
+{
+	s32 result = MIC_RESULT_FATAL_ERROR;
+	
+	if (__init &&
+		chan >= 0 && chan <= 1)
+	{
+		result = __MICQueueCommand(chan, FALSE, 0xffff, status & 0xffff, 0, setCallback);
+	}
+	
+	return result;
+}
+
+s32 MICSetStatus(s32 chan, u32 status)
+{
+	u32 level = IRQ_Disable();
+	s32 result = MICSetStatusAsync(chan, status, __MICSyncCallback);
 	if (result >= MIC_RESULT_READY)
-		return __MICSync(chan);
-	else
-		return result;
+		result = __MICSyncCommand(chan, __MICCold[chan].queue_serial - 1);
+	IRQ_Restore(level);
+	return result;
 }
 
-s32 MICGetBuffsize(s32 chan, s32* size)
+s32 MICGetStatus(s32 chan, u32* status)
 {
 	s32 result = MIC_RESULT_FATAL_ERROR;
 	
 	if (__init &&
 		chan >= 0 && chan <= 1 &&
-		size != NULL)
+		status != NULL)
+	{
+		struct MICControlBlock *cb = &__MICBlock[chan];
+		u32 level = IRQ_Disable();
+		if (cb->is_attached)
+		{
+			*status = cb->last_status;
+			result = MIC_RESULT_READY;
+		}
+		else
+			result = MIC_RESULT_NOCARD;
+		IRQ_Restore(level);
+	}
+	
+	return result;
+}
+
+
+s32 MICSetParamsAsync(s32 chan, s32 size, s32 rate, s32 gain, MICCallback setCallback)
+{
+	s32 result = MIC_RESULT_FATAL_ERROR;
+	
+	if (__init &&
+		chan >= 0 && chan <= 1 &&
+		size >= 0 && rate >= 0 && gain >= 0 &&
+		__MICFindStatus(0, size, rate, gain) >= 0)
+	{
+		result = __MICQueueCommand(chan, FALSE, MIC_STATUS_PARAMS,
+			__MICEncodeStatus(0, __MICFindStatus(0, size, rate, gain)), 0, setCallback);
+	}
+	
+	return result;
+}
+
+s32 MICSetParams(s32 chan, s32 size, s32 rate, s32 gain)
+{
+	u32 level = IRQ_Disable();
+	s32 result = MICSetParamsAsync(chan, size, rate, gain, __MICSyncCallback);
+	if (result >= MIC_RESULT_READY)
+		result = __MICSyncCommand(chan, __MICCold[chan].queue_serial - 1);
+	IRQ_Restore(level);
+	return result;
+}
+
+s32 MICGetParams(s32 chan, s32* size, s32* rate, s32* gain)
+{
+	s32 result = MIC_RESULT_FATAL_ERROR;
+	
+	if (__init &&
+		chan >= 0 && chan <= 1 &&
+		size != NULL &&
+		rate != NULL &&
+		gain != NULL)
 	{
 		struct MICControlBlock *cb = &__MICBlock[chan];
 		u32 level = IRQ_Disable();
 		if (cb->is_attached)
 		{
 			*size = cb->hw_buff_size;
+			*rate = cb->sample_rate;
+			*gain = cb->cold->gain;
 			result = MIC_RESULT_READY;
 		}
 		else
@@ -1168,42 +2857,82 @@ s32 MICGetBuffsize(s32 chan, s32* size)
 }
 
 
-s32 MICSetRateAsync(s32 chan, s32 rate, MICCallback setCallback)
+s32 MICSetBuffsizeAsync(s32 chan, s32 size, MICCallback setCallback)
+{
+	s32 result = MIC_RESULT_FATAL_ERROR;
+	
+	if (__init &&
+		chan >= 0 && chan <= 1 &&
+		size >= 0 &&
+		__MICFindStatus(0, size, MIC_PARAM_KEEP, MIC_PARAM_KEEP) >= 0)
+	{
+		result = __MICQueueCommand(chan, FALSE, MIC_STATUS_SIZE,
+			__MICEncodeStatus(0, __MICFindStatus(0, size, MIC_PARAM_KEEP, MIC_PARAM_KEEP)) & MIC_STATUS_SIZE,
+			0, setCallback);
+	}
+	
+	return result;
+}
+
+s32 MICSetBuffsize(s32 chan, s32 size)
+{
+	u32 level = IRQ_Disable();
+	s32 result = MICSetBuffsizeAsync(chan, size, __MICSyncCallback);
+	if (result >= MIC_RESULT_READY)
+		result = __MICSyncCommand(chan, __MICCold[chan].queue_serial - 1);
+	IRQ_Restore(level);
+	return result;
+}
+
+s32 MICGetBuffsize(s32 chan, s32* size)
 {
 	s32 result = MIC_RESULT_FATAL_ERROR;
 	
 	if (__init &&
 		chan >= 0 && chan <= 1 &&
-		(rate == 11025 || rate == 22050 || rate == 44100))
+		size != NULL)
 	{
+		struct MICControlBlock *cb = &__MICBlock[chan];
 		u32 level = IRQ_Disable();
-		
-		struct MICControlBlock *cb = NULL;
-		if ((result = __MICGetControlBlock(chan, FALSE, &cb)) >= MIC_RESULT_READY)
+		if (cb->is_attached)
 		{
-			cb->status = cb->last_status & ~(MIC_STATUS_22050Hz | MIC_STATUS_44100Hz);
-			if (rate == 22050)
-				cb->status |= MIC_STATUS_22050Hz;
-			else if (rate == 44100)
-				cb->status |= MIC_STATUS_44100Hz;
-			cb->attach_callback = setCallback;
-			cb->set_callback = __MICSetCallback;
+			*size = cb->hw_buff_size;
 			result = MIC_RESULT_READY;
 		}
-		
+		else
+			result = MIC_RESULT_NOCARD;
 		IRQ_Restore(level);
 	}
 	
 	return result;
 }
 
+
+s32 MICSetRateAsync(s32 chan, s32 rate, MICCallback setCallback)
+{
+	s32 result = MIC_RESULT_FATAL_ERROR;
+	
+	if (__init &&
+		chan >= 0 && chan <= 1 &&
+		rate >= 0 &&
+		__MICFindStatus(0, MIC_PARAM_KEEP, rate, MIC_PARAM_KEEP) >= 0)
+	{
+		result = __MICQueueCommand(chan, FALSE, MIC_STATUS_RATE,
+			__MICEncodeStatus(0, __MICFindStatus(0, MIC_PARAM_KEEP, rate, MIC_PARAM_KEEP)) & MIC_STATUS_RATE,
+			0, setCallback);
+	}
+	
+	return result;
+}
+
 s32 MICSetRate(s32 chan, s32 rate)
 {
+	u32 level = IRQ_Disable();
 	s32 result = MICSetRateAsync(chan, rate, __MICSyncCallback);
 	if (result >= MIC_RESULT_READY)
-		return __MICSync(chan);
-	else
-		return result;
+		result = __MICSyncCommand(chan, __MICCold[chan].queue_serial - 1);
+	IRQ_Restore(level);
+	return result;
 }
 
 s32 MICGetRate(s32 chan, s32* rate)
@@ -1236,20 +2965,12 @@ s32 MICSetGainAsync(s32 chan, s32 gain, MICCallback setCallback)
 	
 	if (__init &&
 		chan >= 0 && chan <= 1 &&
-		(gain == 0 || gain == 15))
+		gain >= 0 &&
+		__MICFindStatus(0, MIC_PARAM_KEEP, MIC_PARAM_KEEP, gain) >= 0)
 	{
-		u32 level = IRQ_Disable();
-		
-		struct MICControlBlock *cb = NULL;
-		if ((result = __MICGetControlBlock(chan, FALSE, &cb)) >= MIC_RESULT_READY)
-		{
-			cb->status = (cb->last_status & ~MIC_STATUS_GAIN15) | ((gain == 15) ? MIC_STATUS_GAIN15 : MIC_STATUS_GAIN0);
-			cb->attach_callback = setCallback;
-			cb->set_callback = __MICSetCallback;
-			result = MIC_RESULT_READY;
-		}
-		
-		IRQ_Restore(level);
+		result = __MICQueueCommand(chan, FALSE, MIC_STATUS_GAIN15,
+			__MICEncodeStatus(0, __MICFindStatus(0, MIC_PARAM_KEEP, MIC_PARAM_KEEP, gain)) & MIC_STATUS_GAIN15,
+			0, setCallback);
 	}
 	
 	return result;
@@ -1257,11 +2978,12 @@ s32 MICSetGainAsync(s32 chan, s32 gain, MICCallback setCallback)
 
 s32 MICSetGain(s32 chan, s32 gain)
 {
+	u32 level = IRQ_Disable();
 	s32 result = MICSetGainAsync(chan, gain, __MICSyncCallback);
 	if (result >= MIC_RESULT_READY)
-		return __MICSync(chan);
-	else
-		return result;
+		result = __MICSyncCommand(chan, __MICCold[chan].queue_serial - 1);
+	IRQ_Restore(level);
+	return result;
 }
 
 s32 MICGetGain(s32 chan, s32* gain)
@@ -1276,7 +2998,7 @@ s32 MICGetGain(s32 chan, s32* gain)
 		u32 level = IRQ_Disable();
 		if (cb->is_attached)
 		{
-			*gain = cb->gain;
+			*gain = cb->cold->gain;
 			result = MIC_RESULT_READY;
 		}
 		else
@@ -1300,7 +3022,7 @@ s32 MICGetButton(s32 chan, u32* button)
 		u32 level = IRQ_Disable();
 		if (cb->is_attached)
 		{
-			*button = cb->button;
+			*button = cb->cold->button;
 			result = MIC_RESULT_READY;
 		}
 		else
@@ -1342,18 +3064,7 @@ s32 MICSetOutAsync(s32 chan, u32 pattern, MICCallback setCallback)
 	if (__init &&
 		chan >= 0 && chan <= 1)
 	{
-		u32 level = IRQ_Disable();
-		
-		struct MICControlBlock *cb = NULL;
-		if ((result = __MICGetControlBlock(chan, TRUE, &cb)) >= MIC_RESULT_READY)
-		{
-			cb->status = (cb->last_status & ~0xf) | (pattern & 0xf);
-			cb->attach_callback = setCallback;
-			cb->set_callback = __MICSetCallback;
-			result = MIC_RESULT_READY;
-		}
-		
-		IRQ_Restore(level);
+		result = __MICQueueCommand(chan, TRUE, MIC_STATUS_OUT, pattern & MIC_STATUS_OUT, 0, setCallback);
 	}
 	
 	return result;
@@ -1361,11 +3072,12 @@ s32 MICSetOutAsync(s32 chan, u32 pattern, MICCallback setCallback)
 
 s32 MICSetOut(s32 chan, u32 pattern)
 {
+	u32 level = IRQ_Disable();
 	s32 result = MICSetOutAsync(chan, pattern, __MICSyncCallback);
 	if (result >= MIC_RESULT_READY)
-		return __MICSync(chan);
-	else
-		return result;
+		result = __MICSyncCommand(chan, __MICCold[chan].queue_serial - 1);
+	IRQ_Restore(level);
+	return result;
 }
 
 s32 MICGetOut(s32 chan, u32* pattern)
@@ -1401,23 +3113,10 @@ s32 MICStartAsync(s32 chan, MICCallback startCallback)
 	{
 		u32 level = IRQ_Disable();
 		
-		struct MICControlBlock *cb = NULL;
-		if ((result = __MICGetControlBlock(chan, FALSE, &cb)) >= MIC_RESULT_READY)
+		if ((result = __MICQueueCommand(chan, FALSE, MIC_STATUS_ACTIVE, MIC_STATUS_ACTIVE,
+			MIC_COMMAND_START, startCallback)) >= MIC_RESULT_READY)
 		{
-			cb->status = cb->last_status | MIC_STATUS_ACTIVE;
-			cb->attach_callback = startCallback;
-			cb->set_callback = __MICSetCallback;
-			cb->error_count = 0;
-			cb->buff_ring_cur = 0;
-			
-			int rate = (cb->last_status >> 11) & 3;
-			int size = (cb->last_status >> 13) & 3;
-			cb->timeout.tv_sec = 0;
-			cb->timeout.tv_nsec = __MICTimeoutTable[rate * 4 + size] * ticks_to_nanosecs(92);
-			
-			memset(cb->buff_ring_base, 0, cb->buff_ring_size);
-			
-			result = MIC_RESULT_READY;
+			__MICLink.is_linked = FALSE;
 		}
 		
 		IRQ_Restore(level);
@@ -1428,30 +3127,41 @@ s32 MICStartAsync(s32 chan, MICCallback startCallback)
 
 s32 MICStart(s32 chan)
 {
+	u32 level = IRQ_Disable();
 	s32 result = MICStartAsync(chan, __MICSyncCallback);
 	if (result >= MIC_RESULT_READY)
-		return __MICSync(chan);
-	else
-		return result;
+		result = __MICSyncCommand(chan, __MICCold[chan].queue_serial - 1);
+	IRQ_Restore(level);
+	return result;
 }
 
-
-s32 MICStopAsync(s32 chan, MICCallback stopCallback )
+s32 MICStartLinkedAsync(MICCallback startCallback)
 {
 	s32 result = MIC_RESULT_FATAL_ERROR;
 	
-	if (__init &&
-		chan >= 0 && chan <= 1)
+	if (__init)
 	{
 		u32 level = IRQ_Disable();
 		
-		struct MICControlBlock *cb = NULL;
-		if ((result = __MICGetControlBlock(chan, TRUE, &cb)) >= MIC_RESULT_READY)
+		if (__MICBlock[0].is_attached && __MICBlock[1].is_attached &&
+			__MICBlock[0].sample_rate != __MICBlock[1].sample_rate)
 		{
-			cb->status = cb->last_status & ~MIC_STATUS_ACTIVE;
-			cb->attach_callback = stopCallback;
-			cb->set_callback = __MICSetCallback;
-			result = MIC_RESULT_READY;
+			IRQ_Restore(level);
+			return MIC_RESULT_INVALID_STATE;
+		}
+		
+		// Both status writes go out from the same 5ms alarm tick. Check both
+		// queues first so neither start is left queued on its own; with
+		// interrupts off nothing can change their answer before the starts
+		// are queued.
+		if ((result = __MICCanQueue(0, FALSE)) >= MIC_RESULT_READY &&
+			(result = __MICCanQueue(1, FALSE)) >= MIC_RESULT_READY &&
+			(result = MICStartAsync(0, startCallback)) >= MIC_RESULT_READY &&
+			(result = MICStartAsync(1, startCallback)) >= MIC_RESULT_READY)
+		{
+			__MICLink.is_linked = TRUE;
+			__MICLink.is_aligned = FALSE;
+			__MICLink.read_pos = 0;
 		}
 		
 		IRQ_Restore(level);
@@ -1460,34 +3170,58 @@ s32 MICStopAsync(s32 chan, MICCallback stopCallback )
 	return result;
 }
 
-s32 MICStop(s32 chan)
+s32 MICStartLinked(void)
 {
-	s32 result = MICStopAsync(chan, __MICSyncCallback);
+	u32 level = IRQ_Disable();
+	s32 result = MICStartLinkedAsync(__MICSyncCallback);
 	if (result >= MIC_RESULT_READY)
-		return __MICSync(chan);
-	else
-		return result;
+	{
+		// Watch both before waiting, as either may complete first
+		struct MICSyncWaiter waiter[2];
+		__MICSyncWatch(0, &waiter[0], __MICCold[0].queue_serial - 1);
+		__MICSyncWatch(1, &waiter[1], __MICCold[1].queue_serial - 1);
+		result = __MICSyncWait(0, &waiter[0]);
+		const s32 result_b = __MICSyncWait(1, &waiter[1]);
+		if (result >= MIC_RESULT_READY)
+			result = result_b;
+	}
+	IRQ_Restore(level);
+	return result;
 }
 
 
-s32 MICResetAsync(s32 chan, MICCallback stopCallback )
+s32 MICStopAsync(s32 chan, MICCallback stopCallback )
 {
 	s32 result = MIC_RESULT_FATAL_ERROR;
 	
 	if (__init &&
 		chan >= 0 && chan <= 1)
 	{
-		u32 level = IRQ_Disable();
-		
-		struct MICControlBlock *cb = NULL;
-		if ((result = __MICGetControlBlock(chan, TRUE, &cb)) >= MIC_RESULT_READY)
-		{
-			cb->attach_callback = stopCallback;
-			cb->set_callback = __MICSetCallback;
-			result = MIC_RESULT_READY;
-		}
-		
-		IRQ_Restore(level);
+		result = __MICQueueCommand(chan, TRUE, MIC_STATUS_ACTIVE, 0, 0, stopCallback);
+	}
+	
+	return result;
+}
+
+s32 MICStop(s32 chan)
+{
+	u32 level = IRQ_Disable();
+	s32 result = MICStopAsync(chan, __MICSyncCallback);
+	if (result >= MIC_RESULT_READY)
+		result = __MICSyncCommand(chan, __MICCold[chan].queue_serial - 1);
+	IRQ_Restore(level);
+	return result;
+}
+
+
+s32 MICResetAsync(s32 chan, MICCallback stopCallback )
+{
+	s32 result = MIC_RESULT_FATAL_ERROR;
+	
+	if (__init &&
+		chan >= 0 && chan <= 1)
+	{
+		result = __MICQueueCommand(chan, TRUE, 0, 0, MIC_COMMAND_RESET, stopCallback);
 	}
 	
 	return result;
@@ -1495,11 +3229,12 @@ s32 MICResetAsync(s32 chan, MICCallback stopCallback )
 
 s32 MICReset(s32 chan)
 {
+	u32 level = IRQ_Disable();
 	s32 result = MICResetAsync(chan, __MICSyncCallback);
 	if (result >= MIC_RESULT_READY)
-		return __MICSync(chan);
-	else
-		return result;
+		result = __MICSyncCommand(chan, __MICCold[chan].queue_serial - 1);
+	IRQ_Restore(level);
+	return result;
 }
 
 
@@ -1530,6 +3265,10 @@ s32 MICGetCurrentTop(s32 chan)
 		chan >= 0 && chan <= 1)
 	{
 		struct MICControlBlock *cb = &__MICBlock[chan];
+		u32 top, samples_in_ring, filled;
+		if (__MICReadCursor(chan, &top, &samples_in_ring, &filled, NULL, NULL))
+			return top;
+		
 		u32 level = IRQ_Disable();
 		if (cb->is_attached)
 			result = cb->buff_ring_cur / sizeof(s16);
@@ -1539,6 +3278,27 @@ s32 MICGetCurrentTop(s32 chan)
 	return result;
 }
 
+s32 MICGetPosition(s32 chan, u64* position)
+{
+	s32 result = MIC_RESULT_BUSY;
+	
+	if (__init &&
+		chan >= 0 && chan <= 1 &&
+		position != NULL)
+	{
+		struct MICControlBlock *cb = &__MICBlock[chan];
+		u32 level = IRQ_Disable();
+		if (cb->is_attached)
+		{
+			*position = cb->buff_pos / sizeof(s16);
+			result = MIC_RESULT_READY;
+		}
+		IRQ_Restore(level);
+	}
+	
+	return result;
+}
+
 s32 MICUpdateIndex(s32 chan, s32 index, s32 samples)
 {
 	s32 result = MIC_RESULT_BUSY;
@@ -1549,13 +3309,18 @@ s32 MICUpdateIndex(s32 chan, s32 index, s32 samples)
 		samples >= 0)
 	{
 		struct MICControlBlock *cb = &__MICBlock[chan];
+		u32 top, samples_in_ring, filled;
+		int index_req = index + samples;
+		
+		// This doesn't actually update anything
+		// Weird, but that's how it is
+		if (__MICReadCursor(chan, &top, &samples_in_ring, &filled, NULL, NULL))
+			return (index_req < (int)samples_in_ring) ? index_req : index_req - (int)samples_in_ring;
+		
 		u32 level = IRQ_Disable();
 		if (cb->is_attached)
 		{
-			// This doesn't actually update anything
-			// Weird, but that's how it is
 			int samples_in_ring = cb->buff_ring_size / sizeof(s16);
-			int index_req = index + samples;
 			result = (index_req < samples_in_ring) ? index_req : index_req - samples_in_ring;
 		}
 		IRQ_Restore(level);
@@ -1573,6 +3338,14 @@ s32 MICGetSamplesLeft(s32 chan, s32 index)
 		index >= 0)
 	{
 		struct MICControlBlock *cb = &__MICBlock[chan];
+		u32 top, samples_in_ring, filled;
+		if (__MICReadCursor(chan, &top, &samples_in_ring, &filled, NULL, NULL))
+		{
+			if ((int)top < index) // wrap
+				return samples_in_ring - (index - top);
+			return top - index;
+		}
+		
 		u32 level = IRQ_Disable();
 		if (cb->is_attached)
 		{
@@ -1589,6 +3362,43 @@ s32 MICGetSamplesLeft(s32 chan, s32 index)
 	return result;
 }
 
+// Copy up to samples from index, stopping at top, with the samples further
+// behind top than the filled count zeroed as left over from before
+// MICStart. Returns the unwrapped index past the last sample copied.
+s32 __MICCopySamples(s16 *buffer, const s16 *base, s32 samples_in_ring, s32 top, u32 filled, s32 index, s32 samples)
+{
+	int s = index;
+	const s16 *src = &base[s];
+	
+	int stale = top - index;
+	if (stale < 0)
+		stale += samples_in_ring;
+	if ((u32)stale > filled)
+		stale -= filled;
+	else
+		stale = 0;
+	
+	for (; s < index + samples; s++)
+	{
+		if (s >= samples_in_ring)
+			src = base;
+		
+		if (s == top)
+			break;
+		
+		if (stale)
+		{
+			*buffer++ = 0;
+			src++;
+			stale--;
+		}
+		else
+			*buffer++ = *src++;
+	}
+	
+	return s;
+}
+
 s32 MICGetSamples(s32 chan, s16* buffer, s32 index, s32 samples)
 {
 	s32 result = MIC_RESULT_BUSY;
@@ -1600,27 +3410,336 @@ s32 MICGetSamples(s32 chan, s16* buffer, s32 index, s32 samples)
 		samples >= 0)
 	{
 		struct MICControlBlock *cb = &__MICBlock[chan];
+		u32 top, samples_in_ring, filled, written;
+		s16 *base;
+		
+		// Copy with interrupts on from a snapshot of the cursor. Blocks
+		// landing meanwhile write from the snapshot's top on (the one in
+		// flight included), so the copy is good as long as they have not
+		// come round to index. If they have, or the ring was reconfigured,
+		// it is redone under IRQ_Disable below.
+		const u32 gen = cb->cursor >> MIC_CURSOR_INDEX_BITS;
+		__MICBarrier();
+		if (__MICReadCursor(chan, &top, &samples_in_ring, &filled, &base, &written) &&
+			(u32)index < samples_in_ring)
+		{
+			const u32 block = cb->hw_buff_size / sizeof(s16);
+			int s = __MICCopySamples(buffer, base, samples_in_ring, top, filled, index, samples);
+			__MICBarrier();
+			
+			int back = top - index;
+			if (back < 0)
+				back += samples_in_ring;
+			
+			if ((cb->cursor >> MIC_CURSOR_INDEX_BITS) == gen &&
+				cb->cursor_written - written + block <= samples_in_ring - back)
+			{
+				__MICNoteRead(chan, gen, top, samples_in_ring, written, index, s);
+
+#ifdef MIC_PROFILE
+				if (s > index)
+				{
+					u32 level = IRQ_Disable();
+					__MICProfileRead(chan, index);
+					IRQ_Restore(level);
+				}
+#endif
+				return s;
+			}
+		}
+		
 		u32 level = IRQ_Disable();
 		
 		if (cb->is_attached)
 		{
-			const int samples_in_ring = cb->buff_ring_size / sizeof(s16);
-			const int top = cb->buff_ring_cur / sizeof(s16);
-			int s = index;
-			s16 *src = &cb->buff_ring_base[s];
+			u32 irq_start = gettick();
+			samples_in_ring = cb->buff_ring_size / sizeof(s16);
+			top = cb->buff_ring_cur / sizeof(s16);
+			filled = (cb->buff_pos / sizeof(s16) < samples_in_ring) ?
+				(u32)(cb->buff_pos / sizeof(s16)) : samples_in_ring;
+			
+			int s = __MICCopySamples(buffer, cb->buff_ring_base, samples_in_ring, top, filled, index, samples);
+			result = s;
+			
+			if (samples_in_ring)
+				__MICNoteRead(chan, cb->cursor >> MIC_CURSOR_INDEX_BITS, top, samples_in_ring,
+					(u32)(cb->buff_pos / sizeof(s16)), index, s);
+
+#ifdef MIC_PROFILE
+			if (s > index)
+				__MICProfileRead(chan, index);
+#endif
+
+			__MICIrqStat(chan, irq_start);
+		}
+		
+		IRQ_Restore(level);
+	}
+	
+	return result;
+}
+
+// Called with interrupts off
+void __MICReadSnapshot(s32 chan, struct MICReadSnapshot *snap)
+{
+	struct MICControlBlock *cb = &__MICBlock[chan];
+	
+	snap->gen = cb->cursor >> MIC_CURSOR_INDEX_BITS;
+	snap->top = cb->buff_ring_cur / sizeof(s16);
+	snap->samples_in_ring = cb->buff_ring_size / sizeof(s16);
+	snap->base = cb->buff_ring_base;
+	snap->written = cb->buff_pos / sizeof(s16);
+	snap->filled = (snap->written < (u64)snap->samples_in_ring) ? (u32)snap->written : (u32)snap->samples_in_ring;
+}
+
+s32 MICGetSamplesMulti(u32 mask, s16* buffers[2], s32 index[2], s32 counts[2], s64 positions[2])
+{
+	s32 result = MIC_RESULT_BUSY;
+	
+	if (__init &&
+		mask != 0 && mask <= 3 &&
+		buffers != NULL &&
+		index != NULL &&
+		counts != NULL)
+	{
+		struct MICReadSnapshot snap[2];
+		BOOL attached[2] = { FALSE, FALSE };
+		s32 end[2];
+		s32 chan;
+		
+		for (chan = 0; chan < 2; chan++)
+		{
+			if ((mask & (1 << chan)) &&
+				(buffers[chan] == NULL || index[chan] < 0 || counts[chan] < 0))
+				return MIC_RESULT_FATAL_ERROR;
+		}
+		
+		// Both tops from one critical section, so each is at most one hw
+		// block behind the same instant
+		u32 level = IRQ_Disable();
+		for (chan = 0; chan < 2; chan++)
+		{
+			if ((mask & (1 << chan)) && (attached[chan] = __MICBlock[chan].is_attached))
+				__MICReadSnapshot(chan, &snap[chan]);
+		}
+		IRQ_Restore(level);
+		
+		// Copy with interrupts on, as MICGetSamples does
+		for (chan = 0; chan < 2; chan++)
+		{
+			const struct MICReadSnapshot *sn = &snap[chan];
+			if (attached[chan])
+				end[chan] = __MICCopySamples(buffers[chan], sn->base, sn->samples_in_ring,
+					sn->top, sn->filled, index[chan], counts[chan]);
+		}
+		__MICBarrier();
+		
+		level = IRQ_Disable();
+		u32 irq_start = gettick();
+		
+		result = MIC_RESULT_READY;
+		for (chan = 0; chan < 2; chan++)
+		{
+			struct MICControlBlock *cb = &__MICBlock[chan];
+			struct MICReadSnapshot *sn = &snap[chan];
+			
+			if (!(mask & (1 << chan)))
+				continue;
 			
-			for (; s < index + samples; s++)
+			if (!attached[chan] || !cb->is_attached)
 			{
-				if (s >= samples_in_ring)
-					src = cb->buff_ring_base;
-				
-				if (s == top)
-					break;
+				counts[chan] = 0;
+				result = MIC_RESULT_BUSY;
+				continue;
+			}
+			
+			s32 back = sn->top - index[chan];
+			if (back < 0)
+				back += sn->samples_in_ring;
+			
+			// Reconfigured while copying, or the blocks that landed meanwhile
+			// (and the one in flight) came round to index; redo it from the
+			// current ring, as MICGetSamples does
+			if ((cb->cursor >> MIC_CURSOR_INDEX_BITS) != sn->gen ||
+				cb->cursor_written - (u32)sn->written + cb->hw_buff_size / sizeof(s16) > (u32)(sn->samples_in_ring - back))
+			{
+				__MICReadSnapshot(chan, sn);
+				end[chan] = __MICCopySamples(buffers[chan], sn->base, sn->samples_in_ring,
+					sn->top, sn->filled, index[chan], counts[chan]);
+			}
+			
+			if (positions)
+			{
+				back = sn->top - index[chan];
+				if (back < 0)
+					back += sn->samples_in_ring;
+				positions[chan] = (s64)sn->written - back;
+			}
+			
+#ifdef MIC_PROFILE
+			if (end[chan] > index[chan])
+				__MICProfileRead(chan, index[chan]);
+#endif
+			
+			if (sn->samples_in_ring)
+				__MICNoteRead(chan, sn->gen, sn->top, sn->samples_in_ring, (u32)sn->written, index[chan], end[chan]);
+			
+			counts[chan] = end[chan] - index[chan];
+			index[chan] = (end[chan] >= sn->samples_in_ring) ? end[chan] - sn->samples_in_ring : end[chan];
+		}
+		
+		// One critical section for the pair; charge it to the first channel
+		__MICIrqStat((mask & 1) ? 0 : 1, irq_start);
+		IRQ_Restore(level);
+	}
+	
+	return result;
+}
+
+
+s32 __MICLinkAvailable(void)
+{
+	struct MICControlBlock *left = &__MICBlock[0];
+	struct MICControlBlock *right = &__MICBlock[1];
+	
+	if (!__MICLink.is_linked || !left->is_attached || !right->is_attached)
+		return MIC_RESULT_INVALID_STATE;
+	
+	if (left->buff_pos == 0 || right->buff_pos == 0)
+		return 0;
+	
+	const u64 ticks_per_sec = TB_TIMER_CLOCK * 1000;
+	const u32 rate = left->sample_rate;
+	
+	if (!__MICLink.is_aligned)
+	{
+		// Back each first-block timestamp up by one block to get the time
+		// the channel's first sample was captured
+		u32 start_left = left->first_block_tick -
+			(u32)((left->hw_buff_size / sizeof(s16)) * ticks_per_sec / rate);
+		u32 start_right = right->first_block_tick -
+			(u32)((right->hw_buff_size / sizeof(s16)) * ticks_per_sec / rate);
+		s32 delta = (s32)(start_right - start_left);
+		u32 skip = (u32)((u64)((delta < 0) ? -delta : delta) * rate / ticks_per_sec);
+		
+		__MICLink.skip[0] = (delta > 0) ? skip : 0;
+		__MICLink.skip[1] = (delta < 0) ? skip : 0;
+		__MICLink.is_aligned = TRUE;
+	}
+	
+	u64 avail[2];
+	u64 overrun = 0;
+	int chan;
+	for (chan = 0; chan < 2; chan++)
+	{
+		struct MICControlBlock *cb = &__MICBlock[chan];
+		u64 written = cb->buff_pos / sizeof(s16);
+		u64 start = __MICLink.skip[chan] + __MICLink.read_pos;
+		u64 samples_in_ring = cb->buff_ring_size / sizeof(s16);
+		
+		avail[chan] = (written > start) ? written - start : 0;
+		
+		if (avail[chan] > samples_in_ring && avail[chan] - samples_in_ring > overrun)
+			overrun = avail[chan] - samples_in_ring;
+	}
+	
+	// Anything older than one ring has been overwritten; skip past it on
+	// both channels so they stay aligned
+	if (overrun)
+	{
+		__MICLink.read_pos += overrun;
+		for (chan = 0; chan < 2; chan++)
+		{
+			avail[chan] = (avail[chan] > overrun) ? avail[chan] - overrun : 0;
+			__MICBlock[chan].stats.ring_overruns++;
+		}
+	}
+	
+	return (avail[0] < avail[1]) ? avail[0] : avail[1];
+}
+
+s32 MICGetLinkedSamplesLeft(void)
+{
+	s32 result = MIC_RESULT_BUSY;
+	
+	if (__init)
+	{
+		u32 level = IRQ_Disable();
+		result = __MICLinkAvailable();
+		IRQ_Restore(level);
+	}
+	
+	return result;
+}
+
+s32 MICGetLinkedSamples(s16* buffer, s32 frames)
+{
+	s32 result = MIC_RESULT_BUSY;
+	
+	if (__init &&
+		buffer != NULL &&
+		frames >= 0)
+	{
+		u32 level = IRQ_Disable();
+		
+		if ((result = __MICLinkAvailable()) >= 0)
+		{
+			struct MICControlBlock *left = &__MICBlock[0];
+			struct MICControlBlock *right = &__MICBlock[1];
+			const u32 samples_left = left->buff_ring_size / sizeof(s16);
+			const u32 samples_right = right->buff_ring_size / sizeof(s16);
+			
+			if (frames < result)
+				result = frames;
+			
+			u32 l = (__MICLink.skip[0] + __MICLink.read_pos) % samples_left;
+			u32 r = (__MICLink.skip[1] + __MICLink.read_pos) % samples_right;
+			s32 i;
+			for (i = 0; i < result; i++)
+			{
+				*buffer++ = left->buff_ring_base[l];
+				*buffer++ = right->buff_ring_base[r];
 				
-				*buffer++ = *src++;
+				if (++l == samples_left)
+					l = 0;
+				if (++r == samples_right)
+					r = 0;
 			}
 			
-			result = s;
+			__MICLink.read_pos += result;
+		}
+		
+		IRQ_Restore(level);
+	}
+	
+	return result;
+}
+
+s32 MICGetLinkedOffset(s32* offset)
+{
+	s32 result = MIC_RESULT_FATAL_ERROR;
+	
+	if (__init &&
+		offset != NULL)
+	{
+		u32 level = IRQ_Disable();
+		
+		struct MICControlBlock *left = &__MICBlock[0];
+		struct MICControlBlock *right = &__MICBlock[1];
+		
+		if (!__MICLink.is_linked)
+			result = MIC_RESULT_INVALID_STATE;
+		else if (left->buff_pos == 0 || right->buff_pos == 0)
+			result = MIC_RESULT_BUSY;
+		else
+		{
+			// Project the left channel's latest block forward to the time of
+			// the right channel's latest block and compare sample counts
+			s32 delta = (s32)(right->last_block_tick - left->last_block_tick);
+			s64 projected = (s64)(left->buff_pos / sizeof(s16)) +
+				(s64)delta * left->sample_rate / (TB_TIMER_CLOCK * 1000);
+			*offset = (s32)(projected - (s64)(right->buff_pos / sizeof(s16)));
+			result = MIC_RESULT_READY;
 		}
 		
 		IRQ_Restore(level);
@@ -1669,3 +3788,306 @@ MICCallback MICSetTxCallback(s32 chan, MICCallback txCallback)
 	
 	return result;
 }
+
+s32 MICAddTxListener(s32 chan, MICCallback listener)
+{
+	s32 result = MIC_RESULT_FATAL_ERROR;
+	
+	if (__init &&
+		chan >= 0 && chan <= 1 &&
+		listener != NULL)
+	{
+		struct MICControlBlock *cb = &__MICBlock[chan];
+		u32 level = IRQ_Disable();
+		
+		u32 i;
+		for (i = 0; i < cb->tx_listener_count; i++)
+		{
+			if (cb->cold->tx_listeners[i] == listener)
+				break;
+		}
+		
+		if (i < cb->tx_listener_count)
+			result = MIC_RESULT_INVALID_STATE;
+		else if (cb->tx_listener_count >= MIC_TX_LISTENERS)
+			result = MIC_RESULT_BUSY;
+		else
+		{
+			cb->cold->tx_listeners[cb->tx_listener_count++] = listener;
+			result = MIC_RESULT_READY;
+		}
+		
+		IRQ_Restore(level);
+	}
+	
+	return result;
+}
+
+s32 MICRemoveTxListener(s32 chan, MICCallback listener)
+{
+	s32 result = MIC_RESULT_FATAL_ERROR;
+	
+	if (__init &&
+		chan >= 0 && chan <= 1 &&
+		listener != NULL)
+	{
+		struct MICControlBlock *cb = &__MICBlock[chan];
+		u32 level = IRQ_Disable();
+		
+		result = MIC_RESULT_INVALID_STATE;
+		
+		u32 i;
+		for (i = 0; i < cb->tx_listener_count; i++)
+		{
+			if (cb->cold->tx_listeners[i] == listener)
+			{
+				// Close the gap so the rest keep their order
+				cb->tx_listener_count--;
+				for (; i < cb->tx_listener_count; i++)
+					cb->cold->tx_listeners[i] = cb->cold->tx_listeners[i + 1];
+				result = MIC_RESULT_READY;
+				break;
+			}
+		}
+		
+		IRQ_Restore(level);
+	}
+	
+	return result;
+}
+
+
+s32 MICTraceStart(s32 chan, void* buffer, u32 size)
+{
+	s32 result = MIC_RESULT_FATAL_ERROR;
+	
+	if (__init &&
+		chan >= 0 && chan <= 1 &&
+		buffer != NULL &&
+		size >= sizeof(MICTraceHeader) + sizeof(MICTraceEntry))
+	{
+		struct MICControlBlock *cb = &__MICBlock[chan];
+		u32 level = IRQ_Disable();
+		
+		if (cb->is_attached && !cb->trace_replay)
+		{
+			MICTraceHeader *header = (MICTraceHeader*)buffer;
+			header->magic = MIC_TRACE_MAGIC;
+			header->ticks_per_sec = TB_TIMER_CLOCK * 1000;
+			
+			cb->cold->trace_start = (u8*)buffer;
+			cb->trace_cur = (u8*)(header + 1);
+			cb->cold->trace_end = (u8*)buffer + size;
+			
+			// Seed the trace with the current configuration so a replay
+			// starts from the same state
+			__MICTraceWrite(chan, MIC_TRACE_READ_STATUS, MIC_RESULT_READY, cb->last_status, NULL);
+			result = MIC_RESULT_READY;
+		}
+		else
+			result = MIC_RESULT_INVALID_STATE;
+		
+		IRQ_Restore(level);
+	}
+	
+	return result;
+}
+
+u32 MICTraceStop(s32 chan)
+{
+	u32 result = 0;
+	
+	if (__init &&
+		chan >= 0 && chan <= 1)
+	{
+		struct MICControlBlock *cb = &__MICBlock[chan];
+		u32 level = IRQ_Disable();
+		
+		if (cb->trace_cur && !cb->trace_replay)
+		{
+			result = cb->trace_cur - cb->cold->trace_start;
+			cb->trace_cur = NULL;
+			cb->cold->trace_end = NULL;
+		}
+		
+		IRQ_Restore(level);
+	}
+	
+	return result;
+}
+
+s32 MICReplay(s32 chan, const void* trace, u32 size, s16* buffer, s32 buffsize)
+{
+	s32 result = MIC_RESULT_FATAL_ERROR;
+	const MICTraceHeader *header = (const MICTraceHeader*)trace;
+	
+	if (__init &&
+		chan >= 0 && chan <= 1 &&
+		trace != NULL &&
+		buffer != NULL &&
+		size >= sizeof(MICTraceHeader) &&
+		header->magic == MIC_TRACE_MAGIC)
+	{
+		struct MICControlBlock *cb = &__MICBlock[chan];
+		u32 level = IRQ_Disable();
+		
+		// A pending auto-resume still owns the channel and its ring
+		if (cb->is_attached || cb->trace_cur || cb->cold->result_code == MIC_RESULT_BUSY ||
+			cb->cold->resume_pending)
+		{
+			IRQ_Restore(level);
+			return MIC_RESULT_INVALID_STATE;
+		}
+		
+		cb->trace_replay = TRUE;
+		cb->trace_cur = (u8*)(header + 1);
+		cb->cold->trace_end = (u8*)trace + size;
+		cb->cold->trace_mismatch = 0;
+		cb->cold->replay_dma_callback = NULL;
+		
+		cb->cold->result_code = MIC_RESULT_READY;
+		cb->is_attached = TRUE;
+		cb->is_active = FALSE;
+		cb->exi_callback = NULL;
+		cb->tx_callback = NULL;
+		cb->cold->detach_callback = NULL;
+		cb->cold->attach_callback = NULL;
+		cb->cold->mount_callback = NULL;
+		cb->cold->queue_count = 0;
+		cb->cold->done_serial = cb->cold->queue_serial;
+		cb->cold->queue_done = 0;
+		cb->set_callback = NULL;
+		cb->buff_ring_base = (s16*)(((u32)buffer + 31) & ~31);
+		cb->cold->buff_size = buffsize - (cb->buff_ring_base - buffer);
+		cb->buff_ring_size = 0;
+		cb->buff_ring_cur = 0;
+		cb->hw_buff_size = 0;
+		__MICPublishCursor(chan, TRUE);
+		cb->cold->button = 0;
+		cb->cold->last_button = 0;
+		cb->cold->button_time_delta = 0;
+		cb->cold->button_time_last = gettick();
+		
+		u32 status;
+		if (__MICRawReadStatus(chan, &status) >= MIC_RESULT_READY)
+			__MICUpdateStatus(chan, status, FALSE);
+		
+		IRQ_Restore(level);
+		
+		// Each record is dispatched with interrupts off, as the handlers
+		// expect to run in (non-nesting) interrupt context
+		while (cb->trace_cur + sizeof(MICTraceEntry) <= cb->cold->trace_end)
+		{
+			MICTraceEntry *entry = (MICTraceEntry*)cb->trace_cur;
+			cb->trace_cur += sizeof(MICTraceEntry);
+			
+			level = IRQ_Disable();
+			
+			switch (entry->op)
+			{
+			case MIC_TRACE_EXI_IRQ:
+				__MICExiHandler(chan, EXI_DEVICE_0);
+				break;
+			case MIC_TRACE_ALARM:
+				__MICAlarmPoll(chan);
+				break;
+			case MIC_TRACE_TIMEOUT:
+				__MICDoTimeout(chan);
+				break;
+			case MIC_TRACE_DMA_DONE:
+				cb->trace_cur += entry->value;
+				if (cb->cold->replay_dma_callback)
+				{
+					EXICallback completion = cb->cold->replay_dma_callback;
+					cb->cold->replay_dma_callback = NULL;
+					memcpy(cb->cold->replay_dma_data, entry + 1,
+						(entry->value < cb->cold->replay_dma_len) ? entry->value : cb->cold->replay_dma_len);
+					completion(chan, EXI_DEVICE_0);
+				}
+				else
+					cb->cold->trace_mismatch++;
+				break;
+			default:
+				// A raw transfer the driver never asked for
+				cb->cold->trace_mismatch++;
+				break;
+			}
+			
+			IRQ_Restore(level);
+		}
+		
+		level = IRQ_Disable();
+		SYS_CancelAlarm(__timeout[chan]);
+		cb->is_attached = FALSE;
+		cb->is_active = FALSE;
+		cb->cold->result_code = MIC_RESULT_NOCARD;
+		__MICPublishCursor(chan, TRUE);
+		__MICNotifyListeners(chan, MIC_RESULT_NOCARD);
+		cb->trace_replay = FALSE;
+		cb->trace_cur = NULL;
+		cb->cold->trace_end = NULL;
+		IRQ_Restore(level);
+		
+		result = cb->cold->trace_mismatch;
+	}
+	
+	return result;
+}
+
+u32 MICDumpEvents(MICEvent* events, u32 max)
+{
+	u32 result = 0;
+	
+#ifdef MIC_EVENTLOG
+	if (events != NULL)
+	{
+		u32 level = IRQ_Disable();
+		
+		u32 head = __MICEventHead;
+		u32 count = (head < MIC_EVENTLOG_SIZE) ? head : MIC_EVENTLOG_SIZE;
+		if (count > max)
+			count = max;
+		
+		// Oldest first
+		for (result = 0; result < count; result++)
+			events[result] = __MICEventLog[(head - count + result) & (MIC_EVENTLOG_SIZE - 1)];
+		
+		IRQ_Restore(level);
+	}
+#endif
+	
+	return result;
+}
+
+s32 MICGetProfile(s32 chan, MICProfile* profile)
+{
+	s32 result = MIC_RESULT_FATAL_ERROR;
+	
+	if (__init &&
+		chan >= 0 && chan <= 1 &&
+		profile != NULL)
+	{
+#ifdef MIC_PROFILE
+		struct MICColdBlock *cold = &__MICCold[chan];
+		u32 level = IRQ_Disable();
+		
+		*profile = cold->profile;
+		profile->elapsed = (u32)ticks_to_microsecs(gettime() - cold->profile_start);
+		
+		IRQ_Restore(level);
+#else
+		memset(profile, 0, sizeof(MICProfile));
+#endif
+		result = MIC_RESULT_READY;
+	}
+	
+	return result;
+}
+
+u32 MICLatencyBucketLow(u32 bucket)
+{
+	if (bucket < 4)
+		return bucket;
+	
+	return (4 + (bucket & 3)) << (bucket / 4 - 1);
+}
@@ -32,16 +32,177 @@ extern "C" {
 
 typedef void (*MICCallback)(s32 chan, s32 result);
 
+// Hot-path event log, only recorded when the driver is built with
+// MIC_EVENTLOG defined. MIC_EVENTLOG_SIZE must be a power of two.
+#ifndef MIC_EVENTLOG_SIZE
+#define MIC_EVENTLOG_SIZE               256
+#endif
+
+#define MIC_EVENT_EXI_IRQ                 1  // arg = channel was active
+#define MIC_EVENT_DMA_DONE                2  // arg = ring block index after the block
+#define MIC_EVENT_ALARM                   3  // 5ms poll of an idle channel
+#define MIC_EVENT_TIMEOUT                 4  // watchdog reset; arg = ring block index
+#define MIC_EVENT_LOCK_FAIL               5  // arg = event type of the failing path
+#define MIC_EVENT_OVERFLOW                6  // MIC_STATUS_BUFOVRFLW; arg = ring block index
+#define MIC_EVENT_OVERRUN                 7  // consumer lapped; arg = ring block index
+#define MIC_EVENT_STATUS_RESET            8  // unexpected status change; arg = status
+#define MIC_EVENT_RESUME                  9  // auto-resumed after unplug; arg = gap in samples
+#define MIC_EVENT_RECOVER                10  // restarted after a watchdog reset; arg = samples lost
+
+typedef struct _MICEvent
+{
+	u32 tick;
+	u8 chan;
+	u8 type;
+	u16 arg;
+} MICEvent;
+
+// A break in the sample stream. position counts samples written to the
+// ring since MICStart, so a consumer can splice `samples - filled` of
+// silence in at that point to keep a continuous timebase.
+#define MIC_DISCONT_TIMEOUT               1  // watchdog reset, restarted by auto-recovery
+#define MIC_DISCONT_RESUME                2  // mic unplugged and auto-resumed
+#define MIC_DISCONT_OVERFLOW              3  // mic buffer overflowed (MIC_STATUS_BUFOVRFLW)
+
+typedef struct _MICDiscontinuity
+{
+	u64 position;
+	u32 samples;            // estimated samples lost
+	u32 filled;             // samples of silence already written in their place
+	u32 reason;
+} MICDiscontinuity;
+
+// Driver statistics, see MICGetStats
+typedef struct _MICStats
+{
+	u32 exi_interrupts;     // __MICExiHandler invocations
+	u32 dma_completions;    // hw blocks copied into the ringbuffer
+	u32 status_reads;
+	u32 status_writes;
+	u32 hw_overflows;       // MIC_STATUS_BUFOVRFLW seen
+	u32 ring_overruns;      // a reader came back to samples already overwritten, see MICGetStats
+	u32 timeout_resets;     // device reset by the watchdog
+	u32 resumes;            // reattached by auto-resume after an unplug
+	u32 recoveries;         // restarted by auto-recovery after a watchdog reset
+	u32 recovery_latency_last;  // ticks from the last good block to the first one after recovery
+	u32 recovery_latency_max;   // ticks
+	u32 alarm_wakeups;      // 5ms alarm polls of an attached, idle channel
+	u32 lock_failures;      // EXI_Lock failed in an interrupt/alarm path
+	u32 busy_rejections;    // requests refused with MIC_RESULT_BUSY
+	u32 irq_disabled_max;   // ticks
+	u32 irq_disabled_avg;   // ticks
+	// Watchdog, all in ticks: the measured interval between blocks, its mean
+	// deviation, and the current timeout. A stalled block is detected
+	// watchdog_timeout - block_interval after it was due.
+	u32 block_interval;
+	u32 block_jitter;
+	u32 watchdog_timeout;
+} MICStats;
+
+// Latency profile, only recorded when the driver is built with MIC_PROFILE
+// defined. Latencies are in microseconds; bucket i counts those from
+// MICLatencyBucketLow(i) up to MICLatencyBucketLow(i + 1), exact below 4us
+// then four buckets per power of two. The last bucket is open ended.
+#define MIC_LATENCY_BUCKETS              80
+
+typedef struct _MICProfile
+{
+	u32 elapsed;            // microseconds since MICResetStats (or MICInit)
+	// From a block's DMA completion to MICGetSamples handing out its
+	// samples, taken for the oldest sample of each read
+	u32 reads;
+	u32 latency_max;
+	u64 latency_total;
+	u32 latency[MIC_LATENCY_BUCKETS];
+	// Time spent in the EXI interrupt and DMA completion handlers, including
+	// callbacks, with interrupts masked; in ticks
+	u32 handler_count;
+	u32 handler_max;
+	u64 handler_total;
+} MICProfile;
+
+// EXI traffic trace
+// A trace is a MICTraceHeader followed by MICTraceEntry records. Entries
+// with op MIC_TRACE_DMA_DONE are followed by `value` bytes of DMA payload.
+#define MIC_TRACE_MAGIC          0x4d494354  // 'MICT'
+
+#define MIC_TRACE_EXI_IRQ                 1  // __MICExiHandler entered
+#define MIC_TRACE_ALARM                   2  // __MICAlarmCallback polled the channel
+#define MIC_TRACE_TIMEOUT                 3  // __MICTimeoutCallback fired
+#define MIC_TRACE_READ_STATUS             4  // value = status word read
+#define MIC_TRACE_WRITE_STATUS            5  // value = status word written
+#define MIC_TRACE_READ_DATA               6  // value = DMA length requested
+#define MIC_TRACE_DMA_DONE                7  // value = payload length
+
+typedef struct _MICTraceHeader
+{
+	u32 magic;
+	u32 ticks_per_sec;
+} MICTraceHeader;
+
+typedef struct _MICTraceEntry
+{
+	u32 tick;
+	u8 op;
+	s8 result;
+	u16 value;
+} MICTraceEntry;
+
 void MICInit(void);
 s32 MICProbeEx(s32 chan);
 s32 MICGetResultCode(s32 chan);
 u32 MICGetErrorCount(s32 chan);
+// ring_overruns only sees readers that copy with MICGetSamples or
+// MICGetSamplesMulti (up to 4 per channel, told apart by where their last
+// read ended) and linked reads. Stages that read the ring in place, such
+// as pitch, spectrum, echo and the monitor, are not counted.
+s32 MICGetStats(s32 chan, MICStats* stats);
+s32 MICResetStats(s32 chan);
 
 s32 MICMountAsync(s32 chan, s16* buffer, s32 size, MICCallback detachCallback, MICCallback attachCallback);
 s32 MICMount(s32 chan, s16* buffer, s32 size, MICCallback detachCallback);
 s32 MICUnmount(s32 chan);
 s32 MICGetRingbuffsize(s32 chan, s32* size);
 
+// Auto-resume: when a mounted mic is pulled, remember its status and ring,
+// and when one is plugged back into the slot reattach and restart it from
+// the 5ms alarm without a full MICMount. resumeCallback is called with
+// MIC_RESULT_READY once the channel is back, or MIC_RESULT_WRONGDEVICE if
+// something else was inserted. MICGetResumeGap gives the number of samples
+// lost across the most recent resume.
+s32 MICSetAutoResume(s32 chan, BOOL enable, MICCallback resumeCallback);
+s32 MICGetResumeGap(s32 chan, u32* samples);
+
+// Auto-recovery: when the watchdog has to reset a streaming channel, write
+// its previous status straight back and keep capturing. Each restart is
+// counted in MICStats and recorded as a discontinuity.
+s32 MICSetAutoRecover(s32 chan, BOOL enable);
+// Gap fill: write silence into the ring for each discontinuity, in whole hw
+// blocks, so the ring keeps wall-clock time. At most four blocks (and less
+// than one ring) are written; a longer gap is left to the consumer as the
+// record's samples - filled.
+s32 MICSetGapFill(s32 chan, BOOL enable);
+// Guard region: keep a copy of the first bytes of the ring just past its
+// end, refreshed as each block lands, so a window of up to that many bytes
+// starting anywhere in the ring can be read as one contiguous span. The
+// ring shrinks to make room; the guard is limited to half the buffer given
+// to MICMount and to the ring size. Set it before MICMount or while
+// stopped. MICGetGuard gives the guard in effect.
+s32 MICSetGuard(s32 chan, u32 bytes);
+s32 MICGetGuard(s32 chan, u32* bytes);
+// Pop the oldest unread discontinuity. Returns 1 if one was copied, 0 if
+// there are none.
+s32 MICGetDiscontinuity(s32 chan, MICDiscontinuity* discont);
+// Base of the ringbuffer given to MICMount, for zero-copy readers
+s32 MICGetRingbuff(s32 chan, s16** buffer);
+// Replace the ringbuffer without stopping capture. The switch happens at the
+// next hw block boundary, carrying the samples not yet read by MICGetSamples
+// across; the old buffer may be released once MICGetRingbuff returns the new
+// one. When the ring grows, indices at or behind the current top stay valid,
+// except on a channel started with MICStartLinked, whose ring is realigned to
+// the stream position linked reads go by. Needs the hw block size to be set.
+s32 MICSwapRingBuffer(s32 chan, s16* buffer, s32 size);
+
 s32 MICSetStatusAsync(s32 chan, u32 status, MICCallback setCallback);
 s32 MICSetStatus(s32 chan, u32 status);
 s32 MICGetStatus(s32 chan, u32* status);
@@ -72,6 +233,14 @@ s32 MICGetOut(s32 chan, u32* pattern);
 s32 MICStartAsync(s32 chan, MICCallback startCallback);
 s32 MICStart(s32 chan);
 
+// Start both channels together for linked stereo capture (slot A left,
+// slot B right). Both must be mounted at the same sample rate. Each channel
+// queues its own start, so startCallback is called twice, once with each
+// channel's chan and result, in whichever order they complete. Nothing is
+// queued if either channel cannot take the command.
+s32 MICStartLinkedAsync(MICCallback startCallback);
+s32 MICStartLinked(void);
+
 s32 MICStopAsync(s32 chan, MICCallback stopCallback );
 s32 MICStop(s32 chan);
 
@@ -82,12 +251,61 @@ BOOL MICIsActive(s32 chan);
 BOOL MICIsAttached(s32 chan);
 
 s32 MICGetCurrentTop(s32 chan);
+// Samples written to the ring since MICStart, i.e. the stream position of
+// MICGetCurrentTop. Same numbering as MICDiscontinuity.position.
+s32 MICGetPosition(s32 chan, u64* position);
 s32 MICUpdateIndex(s32 chan, s32 index, s32 samples);
 s32 MICGetSamplesLeft(s32 chan, s32 index);
 s32 MICGetSamples(s32 chan, s16* buffer, s32 index, s32 samples);
+// Read several channels (bit 0 slot A, bit 1 slot B) from cursors taken
+// together, so the reads end within one hw block of each other in time. For
+// each channel in mask, index[chan] is a ring index as for MICGetSamples
+// and is advanced past the samples read, and counts[chan] is the most to
+// read going in and the number read coming out. positions (if not NULL)
+// receives the stream position of each buffer[0], see MICGetPosition; it is
+// negative if the read starts in samples from before MICStart, which come
+// out as silence. Returns MIC_RESULT_BUSY, with that channel's count 0, if a
+// channel in mask is not attached.
+s32 MICGetSamplesMulti(u32 mask, s16* buffers[2], s32 index[2], s32 counts[2], s64 positions[2]);
+
+// Linked stereo reads. Frames are interleaved left/right and time-aligned
+// from the channels' start times; each read consumes what it returns.
+s32 MICGetLinkedSamplesLeft(void);
+s32 MICGetLinkedSamples(s16* buffer, s32 frames);
+// How many samples the left channel currently leads the right channel by
+s32 MICGetLinkedOffset(s32* offset);
 
 MICCallback MICSetExiCallback(s32 chan, MICCallback exiCallback);
 MICCallback MICSetTxCallback (s32 chan, MICCallback txCallback );
+// Block listeners: called from the EXI interrupt after the tx callback, for
+// each block received, in the order they were added. Unlike the tx callback
+// they stay across MICUnmount/MICMount, so independent users of a channel
+// can come and go in any order. Up to 8 per channel; MICAddTxListener
+// returns MIC_RESULT_BUSY when full and MIC_RESULT_INVALID_STATE if the
+// listener is already added, MICRemoveTxListener MIC_RESULT_INVALID_STATE
+// if it was not. Listeners are also called with MIC_RESULT_INVALID_STATE
+// when the channel stops and MIC_RESULT_NOCARD when it goes away. A
+// listener must not add or remove listeners.
+s32 MICAddTxListener(s32 chan, MICCallback listener);
+s32 MICRemoveTxListener(s32 chan, MICCallback listener);
+
+// Start logging raw EXI traffic for chan into buffer. Logging stops quietly
+// when the buffer fills; MICTraceStop returns the number of bytes used.
+s32 MICTraceStart(s32 chan, void* buffer, u32 size);
+u32 MICTraceStop(s32 chan);
+// Feed a recorded trace back through the driver as fast as possible, with
+// buffer standing in for the ringbuffer given to MICMount. The channel must
+// not be mounted. Returns the number of trace records that did not match
+// what the driver asked for (0 for a faithful replay).
+s32 MICReplay(s32 chan, const void* trace, u32 size, s16* buffer, s32 buffsize);
+
+// Copy up to max of the most recent hot-path events, oldest first. Returns
+// the number copied (always 0 without MIC_EVENTLOG).
+u32 MICDumpEvents(MICEvent* events, u32 max);
+
+// Copy the latency profile of chan. All zero without MIC_PROFILE.
+s32 MICGetProfile(s32 chan, MICProfile* profile);
+u32 MICLatencyBucketLow(u32 bucket);
 
 
 #ifdef __cplusplus
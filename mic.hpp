@@ -0,0 +1,467 @@
+#ifndef __MIC_HPP__
+#define __MIC_HPP__
+
+// C++20 coroutine layer over the MIC*Async API.
+//
+//     mic::Task run(s16 *ring)
+//     {
+//         auto [result, channel] = co_await mic::mount(0, ring, MIC_RINGBUFF_SIZE);
+//         if (result < MIC_RESULT_READY)
+//             co_return;
+//         co_await channel.set_params(128, 11025, 15);
+//         co_await channel.start();
+//
+//         mic::SampleStream stream(channel.get());
+//         for (;;)
+//             process(co_await stream.next());
+//     }
+//
+// Driver callbacks run from EXI interrupt and alarm context, so completions
+// never resume a coroutine directly; they park it on a ready list that the
+// game thread drains with mic::resume_ready() (once per frame, say). Each
+// awaiter lives in the awaiting coroutine's frame and is linked into a
+// per-channel list while pending, so no operation allocates.
+
+#include <coroutine>
+#include <span>
+#include <utility>
+
+#include <ogcsys.h>
+
+#include "processor.h"
+
+#include "mic.h"
+
+namespace mic {
+
+namespace detail {
+
+struct IrqGuard
+{
+	u32 level;
+	
+	IrqGuard() noexcept : level(IRQ_Disable()) {}
+	~IrqGuard() { IRQ_Restore(level); }
+	IrqGuard(const IrqGuard&) = delete;
+	IrqGuard& operator=(const IrqGuard&) = delete;
+};
+
+struct Waiter
+{
+	Waiter *next = nullptr;
+	std::coroutine_handle<> handle;
+	s32 chan = 0;
+	s32 result = MIC_RESULT_BUSY;
+	bool done = false;
+	// Set while the MIC*Async call is in progress; a completion that arrives
+	// synchronously then just records the result instead of queueing a resume
+	bool issuing = false;
+};
+
+struct WaitList
+{
+	Waiter *head = nullptr;
+	Waiter *tail = nullptr;
+	
+	void push(Waiter *w) noexcept
+	{
+		w->next = nullptr;
+		if (tail)
+			tail->next = w;
+		else
+			head = w;
+		tail = w;
+	}
+	
+	Waiter* pop() noexcept
+	{
+		Waiter *w = head;
+		if (w)
+		{
+			head = w->next;
+			if (head == nullptr)
+				tail = nullptr;
+		}
+		return w;
+	}
+	
+	void remove(Waiter *w) noexcept
+	{
+		Waiter *prev = nullptr;
+		for (Waiter *cur = head; cur; prev = cur, cur = cur->next)
+		{
+			if (cur != w)
+				continue;
+			if (prev)
+				prev->next = cur->next;
+			else
+				head = cur->next;
+			if (tail == cur)
+				tail = prev;
+			return;
+		}
+	}
+};
+
+// The driver completes queued commands in submission order, so awaiters of
+// Set/Start/Stop/Reset are matched to callbacks FIFO per channel
+inline WaitList commands[2];
+inline Waiter *mount_waiter[2];
+inline Waiter *stream_waiter[2];
+inline WaitList ready;
+
+inline void complete(Waiter *w, s32 result) noexcept
+{
+	w->result = result;
+	w->done = true;
+	if (!w->issuing)
+		ready.push(w);
+}
+
+inline void on_command(s32 chan, s32 result)
+{
+	if (Waiter *w = commands[chan].pop())
+		complete(w, result);
+}
+
+inline void on_mount(s32 chan, s32 result)
+{
+	Waiter *w = mount_waiter[chan];
+	mount_waiter[chan] = nullptr;
+	if (w)
+		complete(w, result);
+}
+
+inline void on_tx(s32 chan, s32 result)
+{
+	Waiter *w = stream_waiter[chan];
+	stream_waiter[chan] = nullptr;
+	if (w)
+		complete(w, result);
+}
+
+template<typename Issue>
+struct CommandAwaiter : Waiter
+{
+	Issue issue;
+	
+	CommandAwaiter(s32 c, Issue i) noexcept : issue(i) { chan = c; }
+	
+	bool await_ready() const noexcept { return chan < 0 || chan > 1; }
+	
+	bool await_suspend(std::coroutine_handle<> h) noexcept
+	{
+		IrqGuard irq;
+		
+		handle = h;
+		commands[chan].push(this);
+		
+		issuing = true;
+		s32 r = issue(on_command);
+		issuing = false;
+		
+		if (r < MIC_RESULT_READY)
+		{
+			commands[chan].remove(this);
+			result = r;
+			return false;
+		}
+		
+		return !done;
+	}
+	
+	s32 await_resume() const noexcept
+	{
+		return (chan < 0 || chan > 1) ? MIC_RESULT_FATAL_ERROR : result;
+	}
+};
+
+} // namespace detail
+
+// Minimal fire-and-forget coroutine type for driving the awaitables below.
+// Starts eagerly and frees its frame when it finishes.
+struct Task
+{
+	struct promise_type
+	{
+		Task get_return_object() noexcept { return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() noexcept {}
+		void unhandled_exception() noexcept {}
+	};
+};
+
+// Resume every coroutine whose MIC operation has completed. Call from
+// thread context, never from a MIC callback.
+inline void resume_ready()
+{
+	for (;;)
+	{
+		detail::Waiter *w;
+		{
+			detail::IrqGuard irq;
+			w = detail::ready.pop();
+		}
+		if (w == nullptr)
+			break;
+		w->handle.resume();
+	}
+}
+
+// Awaitable command wrappers; each yields the MIC_RESULT_* the driver
+// reported, or the immediate error if the request was refused.
+inline auto set_params(s32 chan, s32 size, s32 rate, s32 gain)
+{
+	return detail::CommandAwaiter(chan, [=](MICCallback cb) { return MICSetParamsAsync(chan, size, rate, gain, cb); });
+}
+
+inline auto set_buffsize(s32 chan, s32 size)
+{
+	return detail::CommandAwaiter(chan, [=](MICCallback cb) { return MICSetBuffsizeAsync(chan, size, cb); });
+}
+
+inline auto set_rate(s32 chan, s32 rate)
+{
+	return detail::CommandAwaiter(chan, [=](MICCallback cb) { return MICSetRateAsync(chan, rate, cb); });
+}
+
+inline auto set_gain(s32 chan, s32 gain)
+{
+	return detail::CommandAwaiter(chan, [=](MICCallback cb) { return MICSetGainAsync(chan, gain, cb); });
+}
+
+inline auto start(s32 chan)
+{
+	return detail::CommandAwaiter(chan, [=](MICCallback cb) { return MICStartAsync(chan, cb); });
+}
+
+inline auto stop(s32 chan)
+{
+	return detail::CommandAwaiter(chan, [=](MICCallback cb) { return MICStopAsync(chan, cb); });
+}
+
+inline auto reset(s32 chan)
+{
+	return detail::CommandAwaiter(chan, [=](MICCallback cb) { return MICResetAsync(chan, cb); });
+}
+
+// Owns a mounted channel; stops and unmounts it on destruction. Stopping an
+// active channel blocks in MICStop, so don't let one die in a callback.
+class MicChannel
+{
+public:
+	MicChannel() noexcept = default;
+	explicit MicChannel(s32 chan) noexcept : chan_(chan) {}
+	MicChannel(MicChannel&& other) noexcept : chan_(std::exchange(other.chan_, -1)) {}
+	
+	MicChannel& operator=(MicChannel&& other) noexcept
+	{
+		if (this != &other)
+		{
+			reset();
+			chan_ = std::exchange(other.chan_, -1);
+		}
+		return *this;
+	}
+	
+	MicChannel(const MicChannel&) = delete;
+	MicChannel& operator=(const MicChannel&) = delete;
+	
+	~MicChannel() { reset(); }
+	
+	void reset() noexcept
+	{
+		if (chan_ >= 0)
+		{
+			if (MICIsActive(chan_))
+				MICStop(chan_);
+			MICUnmount(chan_);
+			chan_ = -1;
+		}
+	}
+	
+	s32 release() noexcept { return std::exchange(chan_, -1); }
+	s32 get() const noexcept { return chan_; }
+	explicit operator bool() const noexcept { return chan_ >= 0; }
+	
+	auto set_params(s32 size, s32 rate, s32 gain) const { return mic::set_params(chan_, size, rate, gain); }
+	auto set_buffsize(s32 size) const { return mic::set_buffsize(chan_, size); }
+	auto set_rate(s32 rate) const { return mic::set_rate(chan_, rate); }
+	auto set_gain(s32 gain) const { return mic::set_gain(chan_, gain); }
+	auto start() const { return mic::start(chan_); }
+	auto stop() const { return mic::stop(chan_); }
+	
+private:
+	s32 chan_ = -1;
+};
+
+struct Mounted
+{
+	s32 result;
+	MicChannel channel;     // empty unless result >= MIC_RESULT_READY
+};
+
+namespace detail {
+
+struct MountAwaiter : Waiter
+{
+	s16 *buffer;
+	s32 size;
+	MICCallback detach;
+	
+	MountAwaiter(s32 c, s16 *b, s32 s, MICCallback d) noexcept : buffer(b), size(s), detach(d) { chan = c; }
+	
+	bool await_ready() const noexcept { return false; }
+	
+	bool await_suspend(std::coroutine_handle<> h) noexcept
+	{
+		if (chan < 0 || chan > 1)
+		{
+			result = MIC_RESULT_FATAL_ERROR;
+			return false;
+		}
+		
+		IrqGuard irq;
+		
+		if (mount_waiter[chan])
+		{
+			result = MIC_RESULT_BUSY;
+			return false;
+		}
+		
+		handle = h;
+		mount_waiter[chan] = this;
+		
+		// MICMountAsync calls the attach callback before returning when it
+		// gets the bus straight away
+		issuing = true;
+		s32 r = MICMountAsync(chan, buffer, size, detach, on_mount);
+		issuing = false;
+		
+		if (done)
+			return false;
+		
+		if (r < MIC_RESULT_READY)
+		{
+			mount_waiter[chan] = nullptr;
+			result = r;
+			return false;
+		}
+		
+		return true;
+	}
+	
+	Mounted await_resume() noexcept
+	{
+		if (result >= MIC_RESULT_READY)
+			return { result, MicChannel(chan) };
+		return { result, MicChannel() };
+	}
+};
+
+} // namespace detail
+
+inline detail::MountAwaiter mount(s32 chan, s16 *buffer, s32 size, MICCallback detach = nullptr)
+{
+	return detail::MountAwaiter(chan, buffer, size, detach);
+}
+
+// Zero-copy view of new samples as the driver writes them. Each next()
+// yields the contiguous run from the last read position up to the current
+// top (or the ring end; the wrapped part comes on the following call), or
+// suspends until the next hw block lands. Spans point into the live
+// ringbuffer and stay valid until the producer laps them. One stream per
+// channel; it is a block listener of the channel while it exists, and if it
+// could not be added next() never suspends.
+class SampleStream
+{
+public:
+	explicit SampleStream(s32 chan) noexcept : chan_(chan)
+	{
+		detail::IrqGuard irq;
+		read_ = MICGetCurrentTop(chan_);
+		if (read_ < 0)
+			read_ = 0;
+		listening_ = MICAddTxListener(chan_, detail::on_tx) >= MIC_RESULT_READY;
+	}
+	
+	~SampleStream()
+	{
+		detail::IrqGuard irq;
+		if (listening_)
+			MICRemoveTxListener(chan_, detail::on_tx);
+		detail::stream_waiter[chan_] = nullptr;
+	}
+	
+	SampleStream(const SampleStream&) = delete;
+	SampleStream& operator=(const SampleStream&) = delete;
+	
+	struct NextAwaiter : detail::Waiter
+	{
+		SampleStream *stream;
+		
+		bool await_ready() const noexcept { return stream->available(); }
+		
+		bool await_suspend(std::coroutine_handle<> h) noexcept
+		{
+			detail::IrqGuard irq;
+			if (!stream->listening_ || stream->available() || !MICIsActive(chan))
+				return false;
+			handle = h;
+			detail::stream_waiter[chan] = this;
+			return true;
+		}
+		
+		// Empty if the channel is not running, or stopped or detached while
+		// waiting (the driver calls its listeners then too)
+		std::span<const s16> await_resume() noexcept { return stream->take(); }
+	};
+	
+	NextAwaiter next() noexcept
+	{
+		NextAwaiter a;
+		a.chan = chan_;
+		a.stream = this;
+		return a;
+	}
+	
+private:
+	bool available() const noexcept { return MICGetCurrentTop(chan_) != read_; }
+	
+	std::span<const s16> take() noexcept
+	{
+		s16 *base;
+		s32 size;
+		s32 top = MICGetCurrentTop(chan_);
+		
+		if (top < 0 || top == read_ ||
+			MICGetRingbuff(chan_, &base) < MIC_RESULT_READY ||
+			MICGetRingbuffsize(chan_, &size) < MIC_RESULT_READY)
+		{
+			return {};
+		}
+		
+		const s32 samples_in_ring = size / sizeof(s16);
+		
+		// MICSwapRingBuffer shrank the ring past the read position
+		if (read_ >= samples_in_ring)
+			read_ = top;
+		if (top == read_)
+			return {};
+		
+		const s32 start = read_;
+		const s32 end = (top > start) ? top : samples_in_ring;
+		
+		read_ = (end >= samples_in_ring) ? 0 : end;
+		return { base + start, static_cast<size_t>(end - start) };
+	}
+	
+	s32 chan_;
+	s32 read_;
+	bool listening_;
+};
+
+} // namespace mic
+
+#endif
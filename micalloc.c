@@ -0,0 +1,137 @@
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <ogcsys.h>
+
+#include "processor.h"
+#include "system.h"
+#include "lwp_heap.h"
+
+#include "mic.h"
+#include "micalloc.h"
+
+
+static MICAllocHook __MICAllocHook = NULL;
+static MICFreeHook __MICFreeHook = NULL;
+
+#ifdef HW_RVL
+static heap_cntrl __MICMem2Heap;
+static u8 *__MICMem2Pool = NULL;
+#endif
+
+
+static void* __MICDefaultAlloc(u32 size, u32 placement);
+static void __MICDefaultFree(void* ptr, u32 placement);
+
+
+static void* __MICDefaultAlloc(u32 size, u32 placement)
+{
+#ifdef HW_RVL
+	if (placement == MIC_RING_MEM2)
+	{
+		u32 level = IRQ_Disable();
+		
+		if (__MICMem2Pool == NULL)
+		{
+			__MICMem2Pool = SYS_AllocArena2MemLo(MIC_RING_MEM2_POOL, MIC_RING_ALIGN);
+			if (__MICMem2Pool != NULL)
+				__lwp_heap_init(&__MICMem2Heap, __MICMem2Pool, MIC_RING_MEM2_POOL, MIC_RING_ALIGN);
+		}
+		
+		// The heap only guarantees 8-byte alignment; over-allocate, align
+		// up, and keep the raw pointer just below the ring for freeing
+		u8 *raw = __MICMem2Pool ? __lwp_heap_allocate(&__MICMem2Heap, size + MIC_RING_ALIGN) : NULL;
+		
+		IRQ_Restore(level);
+		
+		if (raw != NULL)
+		{
+			u8 *ring = (u8*)(((u32)raw + sizeof(u8*) + MIC_RING_ALIGN - 1) & ~(MIC_RING_ALIGN - 1));
+			((u8**)ring)[-1] = raw;
+			return ring;
+		}
+		
+		// Pool exhausted; MEM1 is slower to share but better than nothing
+	}
+#endif
+	
+	return memalign(MIC_RING_ALIGN, size);
+}
+
+static void __MICDefaultFree(void* ptr, u32 placement)
+{
+#ifdef HW_RVL
+	// Rings that fell back to MEM1 came from memalign
+	if (__MICMem2Pool != NULL &&
+		(u8*)ptr >= __MICMem2Pool && (u8*)ptr < __MICMem2Pool + MIC_RING_MEM2_POOL)
+	{
+		u32 level = IRQ_Disable();
+		__lwp_heap_free(&__MICMem2Heap, ((u8**)ptr)[-1]);
+		IRQ_Restore(level);
+		return;
+	}
+#endif
+	
+	free(ptr);
+}
+
+void MICSetAllocHooks(MICAllocHook allocHook, MICFreeHook freeHook)
+{
+	u32 level = IRQ_Disable();
+	
+	if (allocHook != NULL && freeHook != NULL)
+	{
+		__MICAllocHook = allocHook;
+		__MICFreeHook = freeHook;
+	}
+	else
+	{
+		__MICAllocHook = NULL;
+		__MICFreeHook = NULL;
+	}
+	
+	IRQ_Restore(level);
+}
+
+s16* MICAllocRing(s32* size, u32 placement)
+{
+	if (size == NULL || *size <= 0 ||
+		(placement != MIC_RING_MEM1 && placement != MIC_RING_MEM2))
+		return NULL;
+	
+	u32 bytes = (*size + MIC_RING_GRANULE - 1) & ~(MIC_RING_GRANULE - 1);
+	
+	u8 *ring = __MICAllocHook ? __MICAllocHook(bytes, placement) : __MICDefaultAlloc(bytes, placement);
+	if (ring == NULL)
+		return NULL;
+	
+	// Hooks are trusted to align, but a misaligned ring would silently
+	// shrink in MICMount
+	if ((u32)ring & (MIC_RING_ALIGN - 1))
+	{
+		if (__MICFreeHook)
+			__MICFreeHook(ring, placement);
+		else
+			__MICDefaultFree(ring, placement);
+		return NULL;
+	}
+	
+	// dcbz the whole ring so no line is fetched from memory, then write it
+	// back; later DMA invalidates then never discard or wait on dirty data
+	DCZeroRange(ring, bytes);
+	DCFlushRange(ring, bytes);
+	
+	*size = bytes;
+	return (s16*)ring;
+}
+
+void MICFreeRing(s16* ring, u32 placement)
+{
+	if (ring == NULL)
+		return;
+	
+	if (__MICFreeHook)
+		__MICFreeHook(ring, placement);
+	else
+		__MICDefaultFree(ring, placement);
+}
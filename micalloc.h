@@ -0,0 +1,45 @@
+#ifndef __MICALLOC_H__
+#define __MICALLOC_H__
+
+#include "mic.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Ring sizes are rounded up to a multiple of the largest hw block, so any
+// MICSetBuffsize choice divides them exactly and MICMount wastes nothing
+#define MIC_RING_GRANULE              128
+#define MIC_RING_ALIGN                 32
+
+// Placement hints
+#define MIC_RING_MEM1                   0
+#define MIC_RING_MEM2                   1   // Wii only; MEM1 on GameCube
+
+// Size of the MEM2 pool the built-in allocator carves from the arena on
+// first use
+#ifndef MIC_RING_MEM2_POOL
+#define MIC_RING_MEM2_POOL      256*1024
+#endif
+
+// Allocator hook: return MIC_RING_ALIGN-aligned memory of at least size
+// bytes, or NULL. placement is one of the MIC_RING_* hints.
+typedef void* (*MICAllocHook)(u32 size, u32 placement);
+typedef void (*MICFreeHook)(void* ptr, u32 placement);
+
+// Route MICAllocRing/MICFreeRing through the application's allocator; pass
+// NULLs to go back to the built-in one. Don't switch while rings are out.
+void MICSetAllocHooks(MICAllocHook allocHook, MICFreeHook freeHook);
+
+// A ring for MICMount or MICSwapRingBuffer, size rounded up to
+// MIC_RING_GRANULE. The memory is zeroed and written back from the cache
+// so the first DMA into each block doesn't have to wait for a writeback.
+// The rounded size is returned through size.
+s16* MICAllocRing(s32* size, u32 placement);
+void MICFreeRing(s16* ring, u32 placement);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,373 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <malloc.h>
+#include <ogcsys.h>
+
+#include "processor.h"
+#include "lwp.h"
+#include "semaphore.h"
+
+#include "mic.h"
+#include "miccapture.h"
+
+
+#define MIC_CAPTURE_STACK_SIZE	16*1024
+#define MIC_CAPTURE_PRIORITY	80
+
+#define MIC_WAV_HEADER_SIZE		44
+
+
+struct MICCaptureBlock
+{
+	BOOL is_open;
+	volatile BOOL is_running;
+	
+	FILE *file;
+	u32 format;
+	u32 sample_rate;
+	
+	lwp_t thread;
+	sem_t full_sem;
+	u8 thread_stack[MIC_CAPTURE_STACK_SIZE] ATTRIBUTE_ALIGN(8);
+	
+	// The tx callback fills staging[fill_index] from the driver ringbuffer.
+	// Once full it is marked pending and the writer thread is woken; the
+	// writer clears pending after the buffer has hit the file.
+	s16 *staging[2];
+	volatile BOOL pending[2];
+	u32 pending_len[2];
+	u32 fill_index;
+	u32 fill_len;
+	u32 write_index;
+	
+	// Sample index into the driver ringbuffer of the next unread sample
+	s32 read_index;
+	
+	u32 dropped;
+	u32 written;
+} static __MICCapture[2];
+
+
+static void __MICCaptureTxCallback(s32 chan, s32 result);
+static void __MICCaptureDrain(s32 chan);
+static void __MICCaptureSubmit(struct MICCaptureBlock *cap);
+static u32 __MICCaptureBlocks(s32 chan, u32 bytes);
+static void* __MICCaptureThread(void *arg);
+static BOOL __MICCaptureWriteHeader(struct MICCaptureBlock *cap);
+static void __MICCapturePut16(u8 *p, u32 v);
+static void __MICCapturePut32(u8 *p, u32 v);
+
+
+static void __MICCaptureTxCallback(s32 chan, s32 result)
+{
+	struct MICCaptureBlock *cap = &__MICCapture[chan];
+	
+	// Added before read_index is set; is_open says it has been
+	if (cap->is_open && cap->is_running && result >= MIC_RESULT_READY)
+		__MICCaptureDrain(chan);
+}
+
+static void __MICCaptureDrain(s32 chan)
+{
+	struct MICCaptureBlock *cap = &__MICCapture[chan];
+	
+	s32 ring_size;
+	if (MICGetRingbuffsize(chan, &ring_size) < MIC_RESULT_READY)
+		return;
+	
+	const s32 samples_in_ring = ring_size / sizeof(s16);
+	const s32 top = MICGetCurrentTop(chan);
+	if (top < 0)
+		return;
+	
+	// MICSwapRingBuffer shrank the ring out from under the read position;
+	// how much was lost is not known, so count it as one block
+	if (cap->read_index >= samples_in_ring)
+	{
+		cap->read_index = top;
+		cap->dropped++;
+	}
+	
+	while (cap->read_index != top)
+	{
+		if (cap->pending[cap->fill_index])
+		{
+			// Writer is still busy with both buffers; skip what arrived
+			s32 skipped = top - cap->read_index;
+			if (skipped < 0)
+				skipped += samples_in_ring;
+			cap->dropped += __MICCaptureBlocks(chan, skipped * sizeof(s16));
+			cap->read_index = top;
+			break;
+		}
+		
+		// Copy up to the top or the ring end, whichever comes first, so
+		// MICGetSamples never has to wrap
+		s32 end = (top > cap->read_index) ? top : samples_in_ring;
+		s32 count = end - cap->read_index;
+		s32 room = (MIC_CAPTURE_STAGING_SIZE - cap->fill_len) / sizeof(s16);
+		if (count > room)
+			count = room;
+		
+		MICGetSamples(chan, cap->staging[cap->fill_index] + cap->fill_len / sizeof(s16),
+			cap->read_index, count);
+		
+		cap->fill_len += count * sizeof(s16);
+		cap->read_index += count;
+		if (cap->read_index >= samples_in_ring)
+			cap->read_index = 0;
+		
+		if (cap->fill_len == MIC_CAPTURE_STAGING_SIZE)
+			__MICCaptureSubmit(cap);
+	}
+}
+
+static void __MICCaptureSubmit(struct MICCaptureBlock *cap)
+{
+	cap->pending_len[cap->fill_index] = cap->fill_len;
+	cap->pending[cap->fill_index] = TRUE;
+	cap->fill_index ^= 1;
+	cap->fill_len = 0;
+	LWP_SemPost(cap->full_sem);
+}
+
+// Hw blocks that bytes of sample data span, counting a partial one as whole
+static u32 __MICCaptureBlocks(s32 chan, u32 bytes)
+{
+	s32 block_size;
+	if (MICGetBuffsize(chan, &block_size) < MIC_RESULT_READY || block_size <= 0)
+		return 1;
+	
+	return (bytes + block_size - 1) / block_size;
+}
+
+static void* __MICCaptureThread(void *arg)
+{
+	struct MICCaptureBlock *cap = (struct MICCaptureBlock*)arg;
+	
+	for (;;)
+	{
+		LWP_SemWait(cap->full_sem);
+		
+		if (!cap->pending[cap->write_index])
+		{
+			if (!cap->is_running)
+				break;
+			continue;
+		}
+		
+		s16 *data = cap->staging[cap->write_index];
+		u32 len = cap->pending_len[cap->write_index];
+		
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		if (cap->format == MIC_CAPTURE_WAV)
+		{
+			u32 i;
+			u16 *p = (u16*)data;
+			for (i = 0; i < len / sizeof(s16); i++)
+				p[i] = (p[i] >> 8) | (p[i] << 8);
+		}
+#endif
+		
+		if (fwrite(data, 1, len, cap->file) == len)
+			cap->written += len;
+		
+		cap->pending[cap->write_index] = FALSE;
+		cap->write_index ^= 1;
+	}
+	
+	return NULL;
+}
+
+static void __MICCapturePut16(u8 *p, u32 v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+}
+
+static void __MICCapturePut32(u8 *p, u32 v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = (v >> 16) & 0xff;
+	p[3] = (v >> 24) & 0xff;
+}
+
+static BOOL __MICCaptureWriteHeader(struct MICCaptureBlock *cap)
+{
+	u8 header[MIC_WAV_HEADER_SIZE];
+	
+	memcpy(&header[0], "RIFF", 4);
+	__MICCapturePut32(&header[4], 36 + cap->written);
+	memcpy(&header[8], "WAVE", 4);
+	
+	memcpy(&header[12], "fmt ", 4);
+	__MICCapturePut32(&header[16], 16);
+	__MICCapturePut16(&header[20], 1);	// PCM
+	__MICCapturePut16(&header[22], 1);	// mono
+	__MICCapturePut32(&header[24], cap->sample_rate);
+	__MICCapturePut32(&header[28], cap->sample_rate * sizeof(s16));
+	__MICCapturePut16(&header[32], sizeof(s16));
+	__MICCapturePut16(&header[34], 16);
+	
+	memcpy(&header[36], "data", 4);
+	__MICCapturePut32(&header[40], cap->written);
+	
+	return fwrite(header, 1, sizeof(header), cap->file) == sizeof(header);
+}
+
+s32 MICCaptureOpen(s32 chan, const char* path, u32 format)
+{
+	s32 result = MIC_RESULT_FATAL_ERROR;
+	
+	if (chan >= 0 && chan <= 1 &&
+		path != NULL &&
+		(format == MIC_CAPTURE_RAW || format == MIC_CAPTURE_WAV))
+	{
+		struct MICCaptureBlock *cap = &__MICCapture[chan];
+		
+		if (cap->is_open)
+			return MIC_RESULT_INVALID_STATE;
+		
+		s32 rate;
+		if ((result = MICGetRate(chan, &rate)) < MIC_RESULT_READY)
+			return result;
+		
+		// Fails unless the driver is initialised
+		if ((result = MICAddTxListener(chan, __MICCaptureTxCallback)) < MIC_RESULT_READY)
+			return result;
+		
+		cap->file = fopen(path, "wb");
+		if (cap->file == NULL)
+		{
+			MICRemoveTxListener(chan, __MICCaptureTxCallback);
+			return MIC_RESULT_FATAL_ERROR;
+		}
+		
+		cap->format = format;
+		cap->sample_rate = rate;
+		cap->dropped = 0;
+		cap->written = 0;
+		cap->fill_index = 0;
+		cap->fill_len = 0;
+		cap->write_index = 0;
+		cap->pending[0] = FALSE;
+		cap->pending[1] = FALSE;
+		cap->staging[0] = memalign(32, MIC_CAPTURE_STAGING_SIZE);
+		cap->staging[1] = memalign(32, MIC_CAPTURE_STAGING_SIZE);
+		
+		if (cap->staging[0] == NULL || cap->staging[1] == NULL ||
+			(format == MIC_CAPTURE_WAV && !__MICCaptureWriteHeader(cap)) ||
+			LWP_SemInit(&cap->full_sem, 0, 3) < 0)
+		{
+			free(cap->staging[0]);
+			free(cap->staging[1]);
+			fclose(cap->file);
+			MICRemoveTxListener(chan, __MICCaptureTxCallback);
+			return MIC_RESULT_FATAL_ERROR;
+		}
+		
+		cap->is_running = TRUE;
+		
+		if (LWP_CreateThread(&cap->thread, __MICCaptureThread, cap,
+			cap->thread_stack, MIC_CAPTURE_STACK_SIZE, MIC_CAPTURE_PRIORITY) < 0)
+		{
+			cap->is_running = FALSE;
+			LWP_SemDestroy(cap->full_sem);
+			free(cap->staging[0]);
+			free(cap->staging[1]);
+			fclose(cap->file);
+			MICRemoveTxListener(chan, __MICCaptureTxCallback);
+			return MIC_RESULT_FATAL_ERROR;
+		}
+		
+		u32 level = IRQ_Disable();
+		cap->read_index = MICGetCurrentTop(chan);
+		cap->is_open = TRUE;
+		IRQ_Restore(level);
+		
+		result = MIC_RESULT_READY;
+	}
+	
+	return result;
+}
+
+s32 MICCaptureClose(s32 chan)
+{
+	s32 result = MIC_RESULT_FATAL_ERROR;
+	
+	if (chan >= 0 && chan <= 1)
+	{
+		struct MICCaptureBlock *cap = &__MICCapture[chan];
+		
+		if (!cap->is_open)
+			return MIC_RESULT_INVALID_STATE;
+		
+		u32 level = IRQ_Disable();
+		
+		// Pick up whatever arrived since the last interrupt, then hand the
+		// partial buffer to the writer if it has room for it
+		__MICCaptureDrain(chan);
+		if (cap->fill_len)
+		{
+			if (!cap->pending[cap->fill_index])
+				__MICCaptureSubmit(cap);
+			else
+				cap->dropped += __MICCaptureBlocks(chan, cap->fill_len);
+		}
+		
+		MICRemoveTxListener(chan, __MICCaptureTxCallback);
+		cap->is_running = FALSE;
+		
+		IRQ_Restore(level);
+		
+		LWP_SemPost(cap->full_sem);
+		LWP_JoinThread(cap->thread, NULL);
+		LWP_SemDestroy(cap->full_sem);
+		
+		result = MIC_RESULT_READY;
+		
+		if (cap->format == MIC_CAPTURE_WAV &&
+			(fseek(cap->file, 0, SEEK_SET) != 0 || !__MICCaptureWriteHeader(cap)))
+		{
+			result = MIC_RESULT_FATAL_ERROR;
+		}
+		
+		if (fclose(cap->file) != 0)
+			result = MIC_RESULT_FATAL_ERROR;
+		
+		free(cap->staging[0]);
+		free(cap->staging[1]);
+		cap->staging[0] = NULL;
+		cap->staging[1] = NULL;
+		cap->file = NULL;
+		cap->is_open = FALSE;
+	}
+	
+	return result;
+}
+
+BOOL MICCaptureIsOpen(s32 chan)
+{
+	if (chan >= 0 && chan <= 1)
+		return __MICCapture[chan].is_open;
+	else
+		return FALSE;
+}
+
+u32 MICCaptureGetDropped(s32 chan)
+{
+	if (chan >= 0 && chan <= 1)
+		return __MICCapture[chan].dropped;
+	else
+		return 0;
+}
+
+u32 MICCaptureGetWritten(s32 chan)
+{
+	if (chan >= 0 && chan <= 1)
+		return __MICCapture[chan].written;
+	else
+		return 0;
+}
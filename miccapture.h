@@ -0,0 +1,37 @@
+#ifndef __MICCAPTURE_H__
+#define __MICCAPTURE_H__
+
+#include "mic.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Size of each of the two staging buffers the capture sink fills from the
+// driver ringbuffer before handing it to the writer thread
+//    32KB =  Approx. 371msec worth @ 44100Hz
+#define MIC_CAPTURE_STAGING_SIZE  32*1024
+
+// Capture file formats
+#define MIC_CAPTURE_RAW                 0   // native-endian s16 samples, no header
+#define MIC_CAPTURE_WAV                 1   // RIFF/WAVE, 16-bit mono PCM
+
+// Begin draining chan into path. The channel must be mounted; capture picks
+// up from the current ringbuffer top, so open it before MICStart to record
+// from the first sample.
+s32 MICCaptureOpen(s32 chan, const char* path, u32 format);
+// Flush the staging buffers, stop the writer thread and (for WAV) fix up the
+// header sizes.
+s32 MICCaptureClose(s32 chan);
+BOOL MICCaptureIsOpen(s32 chan);
+// Number of hw blocks discarded because the writer fell two staging buffers
+// behind (a partial block counts as one), and bytes of sample data written
+// so far.
+u32 MICCaptureGetDropped(s32 chan);
+u32 MICCaptureGetWritten(s32 chan);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,563 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <ogcsys.h>
+
+#include "processor.h"
+#include "lwp.h"
+#include "lwp_watchdog.h"
+#include "semaphore.h"
+
+#include "mic.h"
+#include "micecho.h"
+
+
+#define MIC_ECHO_STACK_SIZE		8*1024
+#define MIC_ECHO_PRIORITY		70
+
+// Output is committed to the read ring this many samples at a time
+#define MIC_ECHO_CHUNK			256
+
+// NLMS step size, 0..2; lower converges slower but misadjusts less
+#define MIC_ECHO_MU				0.5f
+// Mean square reference per tap below which the filter does not adapt
+#define MIC_ECHO_FLOOR			64
+// How long adaptation stays frozen after double-talk, ms
+#define MIC_ECHO_HOLD			30
+
+// Weights are Q24 so small updates accumulate; the filter uses them as Q12.
+// A Q12 weight times a full scale sample only stays in s32 while the weight
+// is under 16.0, so the update holds them to MIC_ECHO_WEIGHT_MAX; real echo
+// paths stay far below it.
+#define MIC_ECHO_WEIGHT_BITS	24
+#define MIC_ECHO_FILTER_BITS	12
+#define MIC_ECHO_WEIGHT_MAX		((1 << 28) - 1)
+
+
+struct MICEchoBlock
+{
+	BOOL is_open;
+	volatile BOOL is_running;
+	
+	lwp_t thread;
+	sem_t wake_sem;
+	u8 thread_stack[MIC_ECHO_STACK_SIZE] ATTRIBUTE_ALIGN(8);
+	
+	u32 input_rate;
+	u32 ref_rate;
+	u32 ref_step;           // Q16 reference samples per mic sample
+	u32 taps;
+	u32 hold_samples;
+	volatile u32 delay_ticks;
+	
+	// Driver ring as of the last pass; a swap resyncs the read position
+	s16 *ring_base;
+	s32 ring_samples;
+	s32 read_index;
+	
+	// Top, time and stream position of the newest block, from the tx callback
+	volatile s32 block_top;
+	volatile u32 block_tick;
+	volatile u64 block_pos;
+	
+	// Reference ring. anchor_index is the reference sample that plays at
+	// anchor_tick; both move together on every push.
+	s16 ref[MIC_ECHO_REF_SAMPLES];
+	u32 ref_head;
+	u32 anchor_index;
+	u32 anchor_tick;
+	BOOL has_anchor;
+	
+	// Filter state. The delay line is mirrored so the newest taps samples
+	// are always contiguous, newest first.
+	s32 weights[MIC_ECHO_TAPS_MAX];
+	s16 line[2 * MIC_ECHO_TAPS_MAX];
+	u32 line_index;
+	u64 energy;
+	s32 ref_peak;
+	u32 hold;
+	
+	f32 power_mic;
+	f32 power_err;
+	u32 ref_missing;
+	u32 doubletalk;
+	
+	// Echo-reduced output. out_pos is the stream position of out_head.
+	s16 chunk[MIC_ECHO_CHUNK];
+	s16 out[MIC_ECHO_OUT_SAMPLES];
+	u32 out_head;
+	u32 out_tail;
+	u64 out_pos;
+	u32 out_dropped;
+} static __MICEcho[2];
+
+
+static void __MICEchoTxCallback(s32 chan, s32 result);
+static void* __MICEchoThread(void *arg);
+static void __MICEchoProcess(s32 chan);
+static s16 __MICEchoCancel(struct MICEchoBlock *eb, s16 d, s16 r);
+static void __MICEchoWrite(struct MICEchoBlock *eb, const s16 *samples, u32 count);
+static void __MICEchoCommit(struct MICEchoBlock *eb, u32 count, u64 position);
+
+
+static void __MICEchoTxCallback(s32 chan, s32 result)
+{
+	struct MICEchoBlock *eb = &__MICEcho[chan];
+	
+	// Added before read_index is set; is_open says it has been
+	if (eb->is_open && eb->is_running && result >= MIC_RESULT_READY)
+	{
+		eb->block_top = MICGetCurrentTop(chan);
+		eb->block_tick = gettick();
+		MICGetPosition(chan, (u64*)&eb->block_pos);
+		LWP_SemPost(eb->wake_sem);
+	}
+}
+
+static void* __MICEchoThread(void *arg)
+{
+	s32 chan = (s32)arg;
+	struct MICEchoBlock *eb = &__MICEcho[chan];
+	
+	for (;;)
+	{
+		LWP_SemWait(eb->wake_sem);
+		
+		if (!eb->is_running)
+			break;
+		
+		__MICEchoProcess(chan);
+	}
+	
+	return NULL;
+}
+
+static void __MICEchoProcess(s32 chan)
+{
+	struct MICEchoBlock *eb = &__MICEcho[chan];
+	
+	s16 *base;
+	s32 size;
+	if (MICGetRingbuff(chan, &base) < MIC_RESULT_READY ||
+		MICGetRingbuffsize(chan, &size) < MIC_RESULT_READY)
+		return;
+	
+	u32 level = IRQ_Disable();
+	const s32 top = eb->block_top;
+	const u32 tick = eb->block_tick;
+	const u64 pos = eb->block_pos;
+	const u32 ref_head = eb->ref_head;
+	const u32 anchor_index = eb->anchor_index;
+	const u32 anchor_tick = eb->anchor_tick;
+	const BOOL has_anchor = eb->has_anchor;
+	IRQ_Restore(level);
+	
+	const s32 samples_in_ring = size / sizeof(s16);
+	if (top < 0 || top >= samples_in_ring)
+		return;
+	
+	if (base != eb->ring_base || samples_in_ring != eb->ring_samples)
+	{
+		eb->ring_base = base;
+		eb->ring_samples = samples_in_ring;
+		eb->read_index = top;
+		return;
+	}
+	
+	s32 behind = top - eb->read_index;
+	if (behind < 0)
+		behind += samples_in_ring;
+	
+	// Too close to being overwritten to trust; pick up from the top. The
+	// output gets silence for the skipped stretch.
+	if (behind > samples_in_ring / 2)
+	{
+		eb->read_index = top;
+		return;
+	}
+	
+	if (behind == 0)
+		return;
+	
+	// Where the first sample of this pass falls in the reference, Q16,
+	// relative to anchor_index. Re-anchoring every block absorbs drift
+	// between the audio and mic clocks.
+	const u32 ticks_per_sec = TB_TIMER_CLOCK * 1000;
+	const u32 first_tick = tick - (u32)((u64)(behind - 1) * ticks_per_sec / eb->input_rate);
+	s32 dt = (s32)(first_tick - eb->delay_ticks - anchor_tick);
+	if (dt > (s32)ticks_per_sec)
+		dt = ticks_per_sec;
+	if (dt < -(s32)ticks_per_sec)
+		dt = -(s32)ticks_per_sec;
+	s64 ref_pos = ((s64)dt * eb->ref_rate << 16) / ticks_per_sec;
+	
+	u64 position = pos - behind;
+	u32 n = 0;
+	
+	while (behind)
+	{
+		s16 d = base[eb->read_index];
+		if (++eb->read_index == samples_in_ring)
+			eb->read_index = 0;
+		behind--;
+		
+		// Interpolate the reference at this sample's time, if it is still
+		// (or already) in the reference ring
+		s16 r = 0;
+		const u32 idx = anchor_index + (s32)(ref_pos >> 16);
+		const u32 age = ref_head - 1 - idx;
+		if (has_anchor && age >= 1 && age < MIC_ECHO_REF_SAMPLES * 3 / 4)
+		{
+			const s32 a = eb->ref[idx & (MIC_ECHO_REF_SAMPLES - 1)];
+			const s32 b = eb->ref[(idx + 1) & (MIC_ECHO_REF_SAMPLES - 1)];
+			r = a + (((b - a) * (s32)(ref_pos & 0xffff)) >> 16);
+		}
+		else
+			eb->ref_missing++;
+		ref_pos += eb->ref_step;
+		
+		eb->chunk[n++] = __MICEchoCancel(eb, d, r);
+		
+		if (n == MIC_ECHO_CHUNK || behind == 0)
+		{
+			__MICEchoCommit(eb, n, position);
+			position += n;
+			n = 0;
+		}
+	}
+}
+
+// One sample of NLMS. d is the mic, r the reference at the same time.
+static s16 __MICEchoCancel(struct MICEchoBlock *eb, s16 d, s16 r)
+{
+	const u32 taps = eb->taps;
+	u32 k;
+	
+	if (eb->line_index == 0)
+		eb->line_index = taps;
+	eb->line_index--;
+	
+	const u32 p = eb->line_index;
+	const s32 gone = eb->line[p];
+	eb->line[p] = r;
+	eb->line[p + taps] = r;
+	eb->energy += (u32)(r * r);
+	eb->energy -= (u32)(gone * gone);
+	
+	const s16 *x = &eb->line[p];
+	s32 *w = eb->weights;
+	
+	s64 acc = 0;
+	for (k = 0; k < taps; k++)
+		acc += (w[k] >> (MIC_ECHO_WEIGHT_BITS - MIC_ECHO_FILTER_BITS)) * x[k];
+	
+	const s32 y = (s32)(acc >> MIC_ECHO_FILTER_BITS);
+	s32 e = d - y;
+	if (e > 32767)
+		e = 32767;
+	if (e < -32768)
+		e = -32768;
+	
+	// Peak of the reference over roughly the filter length
+	const s32 mag = (r < 0) ? -r : r;
+	eb->ref_peak -= eb->ref_peak / (s32)taps + 1;
+	if (eb->ref_peak < mag)
+		eb->ref_peak = mag;
+	
+	const BOOL active = eb->energy > (u64)MIC_ECHO_FLOOR * taps;
+	if (active)
+	{
+		const s32 dmag = (d < 0) ? -d : d;
+		if (dmag > MIC_ECHO_DOUBLETALK * eb->ref_peak)
+			eb->hold = eb->hold_samples;
+		
+		eb->power_mic += ((f32)d * d - eb->power_mic) * (1.f / 4096);
+		eb->power_err += ((f32)e * e - eb->power_err) * (1.f / 4096);
+	}
+	
+	if (eb->hold)
+	{
+		eb->hold--;
+		eb->doubletalk++;
+	}
+	else if (active)
+	{
+		// Normalised step, limited so each update fits in s32
+		f32 gf = MIC_ECHO_MU * e * (f32)(1 << MIC_ECHO_WEIGHT_BITS) / (f32)eb->energy;
+		if (gf > 32767.f)
+			gf = 32767.f;
+		if (gf < -32767.f)
+			gf = -32767.f;
+		const s32 g = (s32)gf;
+		
+		// Each update is under 2^30, so the sum cannot overflow before it
+		// is clamped
+		for (k = 0; k < taps; k++)
+		{
+			s32 wk = w[k] + g * x[k];
+			if (wk > MIC_ECHO_WEIGHT_MAX)
+				wk = MIC_ECHO_WEIGHT_MAX;
+			if (wk < -MIC_ECHO_WEIGHT_MAX)
+				wk = -MIC_ECHO_WEIGHT_MAX;
+			w[k] = wk;
+		}
+	}
+	
+	return e;
+}
+
+// Append to the output ring, overwriting the oldest unread samples when
+// the reader falls behind. NULL samples writes silence. Call with IRQs off.
+static void __MICEchoWrite(struct MICEchoBlock *eb, const s16 *samples, u32 count)
+{
+	while (count--)
+	{
+		eb->out[eb->out_head++ & (MIC_ECHO_OUT_SAMPLES - 1)] = samples ? *samples++ : 0;
+		if (eb->out_head - eb->out_tail > MIC_ECHO_OUT_SAMPLES)
+		{
+			eb->out_tail++;
+			eb->out_dropped++;
+		}
+	}
+}
+
+static void __MICEchoCommit(struct MICEchoBlock *eb, u32 count, u64 position)
+{
+	u32 level = IRQ_Disable();
+	
+	// Keep positions exact across skipped input
+	if (position > eb->out_pos)
+	{
+		u64 gap = position - eb->out_pos;
+		if (gap >= MIC_ECHO_OUT_SAMPLES)
+		{
+			eb->out_dropped += eb->out_head - eb->out_tail;
+			eb->out_tail = eb->out_head;
+		}
+		else
+			__MICEchoWrite(eb, NULL, gap);
+	}
+	
+	__MICEchoWrite(eb, eb->chunk, count);
+	eb->out_pos = position + count;
+	
+	IRQ_Restore(level);
+}
+
+s32 MICEchoOpen(s32 chan, u32 ref_rate, u32 taps, u32 delay_ms)
+{
+	s32 result = MIC_RESULT_FATAL_ERROR;
+	
+	if (chan >= 0 && chan <= 1 &&
+		ref_rate >= 8000 && ref_rate <= 96000 &&
+		taps > 0 && taps <= MIC_ECHO_TAPS_MAX &&
+		delay_ms <= 1000)
+	{
+		struct MICEchoBlock *eb = &__MICEcho[chan];
+		
+		if (eb->is_open)
+			return MIC_RESULT_INVALID_STATE;
+		
+		s32 rate;
+		if ((result = MICGetRate(chan, &rate)) < MIC_RESULT_READY)
+			return result;
+		
+		s32 size;
+		if ((result = MICGetRingbuff(chan, &eb->ring_base)) < MIC_RESULT_READY ||
+			(result = MICGetRingbuffsize(chan, &size)) < MIC_RESULT_READY)
+			return result;
+		
+		eb->input_rate = rate;
+		eb->ref_rate = ref_rate;
+		eb->ref_step = ((u64)ref_rate << 16) / rate;
+		eb->taps = taps;
+		eb->hold_samples = rate * MIC_ECHO_HOLD / 1000;
+		eb->delay_ticks = delay_ms * TB_TIMER_CLOCK;
+		eb->ring_samples = size / sizeof(s16);
+		
+		eb->ref_head = 0;
+		eb->has_anchor = FALSE;
+		
+		memset(eb->weights, 0, sizeof(eb->weights));
+		memset(eb->line, 0, sizeof(eb->line));
+		eb->line_index = 0;
+		eb->energy = 0;
+		eb->ref_peak = 0;
+		eb->hold = 0;
+		
+		eb->power_mic = 0.f;
+		eb->power_err = 0.f;
+		eb->ref_missing = 0;
+		eb->doubletalk = 0;
+		
+		eb->out_head = 0;
+		eb->out_tail = 0;
+		eb->out_dropped = 0;
+		
+		if ((result = MICAddTxListener(chan, __MICEchoTxCallback)) < MIC_RESULT_READY)
+			return result;
+		
+		if (LWP_SemInit(&eb->wake_sem, 0, 1) < 0)
+		{
+			MICRemoveTxListener(chan, __MICEchoTxCallback);
+			return MIC_RESULT_FATAL_ERROR;
+		}
+		
+		eb->is_running = TRUE;
+		
+		if (LWP_CreateThread(&eb->thread, __MICEchoThread, (void*)chan,
+			eb->thread_stack, MIC_ECHO_STACK_SIZE, MIC_ECHO_PRIORITY) < 0)
+		{
+			eb->is_running = FALSE;
+			LWP_SemDestroy(eb->wake_sem);
+			MICRemoveTxListener(chan, __MICEchoTxCallback);
+			return MIC_RESULT_FATAL_ERROR;
+		}
+		
+		u32 level = IRQ_Disable();
+		eb->read_index = MICGetCurrentTop(chan);
+		eb->block_top = eb->read_index;
+		eb->block_tick = gettick();
+		MICGetPosition(chan, (u64*)&eb->block_pos);
+		eb->out_pos = eb->block_pos;
+		eb->is_open = TRUE;
+		IRQ_Restore(level);
+		
+		result = MIC_RESULT_READY;
+	}
+	
+	return result;
+}
+
+s32 MICEchoClose(s32 chan)
+{
+	s32 result = MIC_RESULT_FATAL_ERROR;
+	
+	if (chan >= 0 && chan <= 1)
+	{
+		struct MICEchoBlock *eb = &__MICEcho[chan];
+		
+		if (!eb->is_open)
+			return MIC_RESULT_INVALID_STATE;
+		
+		u32 level = IRQ_Disable();
+		MICRemoveTxListener(chan, __MICEchoTxCallback);
+		eb->is_running = FALSE;
+		IRQ_Restore(level);
+		
+		LWP_SemPost(eb->wake_sem);
+		LWP_JoinThread(eb->thread, NULL);
+		LWP_SemDestroy(eb->wake_sem);
+		
+		eb->is_open = FALSE;
+		result = MIC_RESULT_READY;
+	}
+	
+	return result;
+}
+
+s32 MICEchoSetDelay(s32 chan, u32 delay_ms)
+{
+	s32 result = MIC_RESULT_FATAL_ERROR;
+	
+	if (chan >= 0 && chan <= 1 &&
+		delay_ms <= 1000)
+	{
+		struct MICEchoBlock *eb = &__MICEcho[chan];
+		
+		if (!eb->is_open)
+			return MIC_RESULT_INVALID_STATE;
+		
+		eb->delay_ticks = delay_ms * TB_TIMER_CLOCK;
+		result = MIC_RESULT_READY;
+	}
+	
+	return result;
+}
+
+s32 MICEchoPushReference(s32 chan, const s16* samples, u32 count, u32 tick)
+{
+	s32 result = MIC_RESULT_FATAL_ERROR;
+	
+	if (chan >= 0 && chan <= 1 &&
+		samples != NULL)
+	{
+		struct MICEchoBlock *eb = &__MICEcho[chan];
+		
+		if (!eb->is_open)
+			return MIC_RESULT_INVALID_STATE;
+		
+		// The canceller only reads the newest 3/4 of the ring, so a push
+		// never overwrites what it is reading
+		if (count > MIC_ECHO_REF_SAMPLES / 4)
+		{
+			const u32 skip = count - MIC_ECHO_REF_SAMPLES / 4;
+			samples += skip;
+			count -= skip;
+			tick += (u32)((u64)skip * TB_TIMER_CLOCK * 1000 / eb->ref_rate);
+		}
+		
+		const u32 head = eb->ref_head;
+		u32 i;
+		for (i = 0; i < count; i++)
+			eb->ref[(head + i) & (MIC_ECHO_REF_SAMPLES - 1)] = samples[i];
+		
+		u32 level = IRQ_Disable();
+		eb->anchor_index = head;
+		eb->anchor_tick = tick;
+		eb->ref_head = head + count;
+		eb->has_anchor = TRUE;
+		IRQ_Restore(level);
+		
+		result = MIC_RESULT_READY;
+	}
+	
+	return result;
+}
+
+s32 MICEchoRead(s32 chan, s16* buffer, s32 max, u64* position)
+{
+	s32 count = 0;
+	
+	if (chan >= 0 && chan <= 1 &&
+		buffer != NULL)
+	{
+		struct MICEchoBlock *eb = &__MICEcho[chan];
+		
+		u32 level = IRQ_Disable();
+		if (position)
+			*position = eb->out_pos - (eb->out_head - eb->out_tail);
+		while (eb->out_tail != eb->out_head && count < max)
+			buffer[count++] = eb->out[eb->out_tail++ & (MIC_ECHO_OUT_SAMPLES - 1)];
+		IRQ_Restore(level);
+	}
+	
+	return count;
+}
+
+s32 MICEchoGetStats(s32 chan, MICEchoStats* stats)
+{
+	s32 result = MIC_RESULT_FATAL_ERROR;
+	
+	if (chan >= 0 && chan <= 1 &&
+		stats != NULL)
+	{
+		struct MICEchoBlock *eb = &__MICEcho[chan];
+		
+		if (!eb->is_open)
+			return MIC_RESULT_INVALID_STATE;
+		
+		u32 level = IRQ_Disable();
+		const f32 power_mic = eb->power_mic;
+		const f32 power_err = eb->power_err;
+		stats->ref_missing = eb->ref_missing;
+		stats->doubletalk = eb->doubletalk;
+		stats->out_dropped = eb->out_dropped;
+		IRQ_Restore(level);
+		
+		stats->erle = (power_err > 0.f) ? 10.f * log10f(power_mic / power_err) : 0.f;
+		result = MIC_RESULT_READY;
+	}
+	
+	return result;
+}
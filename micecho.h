@@ -0,0 +1,53 @@
+#ifndef __MICECHO_H__
+#define __MICECHO_H__
+
+#include "mic.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Acoustic echo canceller: a fixed-point NLMS filter predicts how the game's
+// output (the reference) reaches the mic and subtracts it, leaving mostly
+// the player's voice.
+#define MIC_ECHO_TAPS_MAX             512   // echo tail at the mic rate
+#define MIC_ECHO_REF_SAMPLES        16384   // reference held, at the reference rate
+#define MIC_ECHO_OUT_SAMPLES         8192   // echo-reduced output held for MICEchoRead
+
+// Adaptation is frozen while the mic is louder than this many times the
+// recent reference peak, taken to mean the player is talking over it.
+#define MIC_ECHO_DOUBLETALK          2.0f
+
+typedef struct _MICEchoStats
+{
+	f32 erle;               // echo return loss enhancement in dB, while reference plays
+	u32 ref_missing;        // mic samples with no reference for their time
+	u32 doubletalk;         // mic samples that did not adapt because of near-end speech
+	u32 out_dropped;        // output overwritten before MICEchoRead got to it
+} MICEchoStats;
+
+// Start cancelling on a mounted channel. ref_rate is the rate of the stream
+// given to MICEchoPushReference; taps sets the echo tail covered; delay_ms
+// is the fixed speaker latency (TV processing etc.) on top of the
+// timestamps. Processing runs on its own thread, reading new blocks
+// straight out of the driver ringbuffer. Reopen after changing the rate.
+s32 MICEchoOpen(s32 chan, u32 ref_rate, u32 taps, u32 delay_ms);
+s32 MICEchoClose(s32 chan);
+s32 MICEchoSetDelay(s32 chan, u32 delay_ms);
+// Queue game output for the canceller. tick is the timebase tick at which
+// samples[0] leaves the console (e.g. when its audio DMA block starts).
+// Mono; mix down first. Best results are with ref_rate equal to the mic rate.
+// Reference is usable for 3/4 of MIC_ECHO_REF_SAMPLES after it is pushed,
+// which has to cover how far ahead it is pushed plus the delay.
+s32 MICEchoPushReference(s32 chan, const s16* samples, u32 count, u32 tick);
+// Copy out up to max echo-reduced samples, oldest first. position (if not
+// NULL) receives the stream position of buffer[0], see MICGetPosition.
+// Returns the number copied.
+s32 MICEchoRead(s32 chan, s16* buffer, s32 max, u64* position);
+s32 MICEchoGetStats(s32 chan, MICEchoStats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
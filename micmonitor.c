@@ -0,0 +1,329 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ogcsys.h>
+
+#include "processor.h"
+#include "lwp_watchdog.h"
+
+#include "mic.h"
+#include "micmonitor.h"
+
+
+// Largest rate trim, as a fraction of the nominal step (1/200 = 0.5%)
+#define MIC_MONITOR_TRIM		200
+
+
+struct MICMonitorBlock
+{
+	BOOL is_open;
+	volatile BOOL is_running;
+	
+	s16 *ring;
+	u32 samples;
+	u32 write;              // output samples produced
+	u32 read;               // output samples consumed
+	u32 head;               // ring index of the next sample written
+	u32 tail;               // ring index of the oldest queued sample
+	
+	// Resampler, all fixed point since it runs in interrupt context
+	u32 step_nominal;       // Q16 input samples per output sample
+	u32 step;
+	u32 phase;              // Q16 position past prev
+	s16 prev;
+	u32 target;             // output samples
+	s32 fill_avg;
+	
+	u32 ticks_per_out;      // Q16 timebase ticks per output sample
+	
+	// Sample index into the driver ringbuffer of the next unread sample
+	s32 read_index;
+	
+	// Output position just past each recent block, and when the block's
+	// last sample was captured
+	u32 record_end[MIC_MONITOR_RECORDS];
+	u32 record_tick[MIC_MONITOR_RECORDS];
+	u32 record_head;
+	
+	MICMonitorStats stats;
+} static __MICMonitor[2];
+
+
+static void __MICMonitorTxCallback(s32 chan, s32 result);
+static void __MICMonitorPush(s32 chan);
+static void __MICMonitorTrim(struct MICMonitorBlock *mb);
+
+
+static void __MICMonitorTxCallback(s32 chan, s32 result)
+{
+	struct MICMonitorBlock *mb = &__MICMonitor[chan];
+	
+	if (mb->is_running && result >= MIC_RESULT_READY)
+		__MICMonitorPush(chan);
+}
+
+static void __MICMonitorPush(s32 chan)
+{
+	struct MICMonitorBlock *mb = &__MICMonitor[chan];
+	
+	s16 *base;
+	s32 ring_size;
+	if (MICGetRingbuff(chan, &base) < MIC_RESULT_READY ||
+		MICGetRingbuffsize(chan, &ring_size) < MIC_RESULT_READY)
+		return;
+	
+	const s32 samples_in_ring = ring_size / sizeof(s16);
+	const s32 top = MICGetCurrentTop(chan);
+	if (top < 0)
+		return;
+	
+	// MICSwapRingBuffer shrank the ring out from under the read position
+	if (mb->read_index >= samples_in_ring)
+		mb->read_index = top;
+	
+	s32 count = top - mb->read_index;
+	if (count < 0)
+		count += samples_in_ring;
+	
+	// Worst case output for this block, with the step trimmed all the way down
+	const u32 worst = (u32)(((u64)count << 16) / (mb->step_nominal - mb->step_nominal / MIC_MONITOR_TRIM)) + 1;
+	if (mb->write - mb->read + worst > mb->samples)
+	{
+		// The mixer is not keeping up; drop the block rather than overwrite
+		// what it has yet to play
+		mb->read_index = top;
+		mb->stats.overruns++;
+		return;
+	}
+	
+	while (mb->read_index != top)
+	{
+		const s32 x = base[mb->read_index];
+		if (++mb->read_index == samples_in_ring)
+			mb->read_index = 0;
+		
+		// Linear interpolation between prev and x at each output instant
+		while (mb->phase < 0x10000)
+		{
+			mb->ring[mb->head] = mb->prev + (((x - mb->prev) * (s32)mb->phase) >> 16);
+			if (++mb->head == mb->samples)
+				mb->head = 0;
+			mb->write++;
+			mb->phase += mb->step;
+		}
+		mb->phase -= 0x10000;
+		mb->prev = x;
+	}
+	
+	mb->record_end[mb->record_head] = mb->write;
+	mb->record_tick[mb->record_head] = gettick();
+	if (++mb->record_head == MIC_MONITOR_RECORDS)
+		mb->record_head = 0;
+	
+	__MICMonitorTrim(mb);
+}
+
+// Proportional control of the resampling step around the target fill:
+// consume input a little faster when too much is queued, slower when too
+// little. Clock drift between the mic and the mixer is a few hundred ppm at
+// most, well inside the trim range.
+static void __MICMonitorTrim(struct MICMonitorBlock *mb)
+{
+	const s32 fill = mb->write - mb->read;
+	mb->stats.fill = fill;
+	mb->fill_avg += (fill - mb->fill_avg) / 8;
+	
+	const s32 limit = mb->step_nominal / MIC_MONITOR_TRIM;
+	s32 trim = (s32)(((s64)(mb->fill_avg - (s32)mb->target) * limit) / (s32)(mb->target + 1));
+	if (trim > limit)
+		trim = limit;
+	if (trim < -limit)
+		trim = -limit;
+	
+	mb->step = mb->step_nominal + trim;
+	mb->stats.step = mb->step;
+}
+
+s32 MICMonitorOpen(s32 chan, s16* ring, u32 samples, u32 out_rate, u32 target_ms)
+{
+	s32 result = MIC_RESULT_FATAL_ERROR;
+	
+	if (chan >= 0 && chan <= 1 &&
+		ring != NULL && samples > 0 &&
+		out_rate >= 8000 && out_rate <= 96000)
+	{
+		struct MICMonitorBlock *mb = &__MICMonitor[chan];
+		
+		if (mb->is_open)
+			return MIC_RESULT_INVALID_STATE;
+		
+		s32 rate;
+		if ((result = MICGetRate(chan, &rate)) < MIC_RESULT_READY)
+			return result;
+		
+		mb->ring = ring;
+		mb->samples = samples;
+		mb->write = 0;
+		mb->read = 0;
+		mb->head = 0;
+		mb->tail = 0;
+		
+		mb->step_nominal = ((u64)rate << 16) / out_rate;
+		mb->step = mb->step_nominal;
+		mb->phase = 0;
+		mb->prev = 0;
+		mb->target = (u64)out_rate * target_ms / 1000;
+		if (mb->target > samples / 2)
+			mb->target = samples / 2;
+		mb->fill_avg = 0;
+		
+		mb->ticks_per_out = ((u64)TB_TIMER_CLOCK * 1000 << 16) / out_rate;
+		
+		memset(mb->record_end, 0, sizeof(mb->record_end));
+		memset(mb->record_tick, 0, sizeof(mb->record_tick));
+		mb->record_head = 0;
+		
+		memset(&mb->stats, 0, sizeof(mb->stats));
+		mb->stats.latency_min = ~0;
+		mb->stats.step = mb->step;
+		
+		u32 level = IRQ_Disable();
+		mb->read_index = MICGetCurrentTop(chan);
+		if (mb->read_index < 0)
+			mb->read_index = 0;
+		if ((result = MICAddTxListener(chan, __MICMonitorTxCallback)) >= MIC_RESULT_READY)
+		{
+			mb->is_running = TRUE;
+			mb->is_open = TRUE;
+		}
+		IRQ_Restore(level);
+	}
+	
+	return result;
+}
+
+s32 MICMonitorClose(s32 chan)
+{
+	s32 result = MIC_RESULT_FATAL_ERROR;
+	
+	if (chan >= 0 && chan <= 1)
+	{
+		struct MICMonitorBlock *mb = &__MICMonitor[chan];
+		
+		if (!mb->is_open)
+			return MIC_RESULT_INVALID_STATE;
+		
+		u32 level = IRQ_Disable();
+		MICRemoveTxListener(chan, __MICMonitorTxCallback);
+		mb->is_running = FALSE;
+		mb->is_open = FALSE;
+		IRQ_Restore(level);
+		
+		result = MIC_RESULT_READY;
+	}
+	
+	return result;
+}
+
+s32 MICMonitorGetQueued(s32 chan, u32* index)
+{
+	s32 result = MIC_RESULT_FATAL_ERROR;
+	
+	if (chan >= 0 && chan <= 1)
+	{
+		struct MICMonitorBlock *mb = &__MICMonitor[chan];
+		
+		if (!mb->is_open)
+			return MIC_RESULT_INVALID_STATE;
+		
+		u32 level = IRQ_Disable();
+		if (index)
+			*index = mb->tail;
+		result = mb->write - mb->read;
+		IRQ_Restore(level);
+	}
+	
+	return result;
+}
+
+s32 MICMonitorConsume(s32 chan, u32 count, u32 tick)
+{
+	s32 result = MIC_RESULT_FATAL_ERROR;
+	
+	if (chan >= 0 && chan <= 1)
+	{
+		struct MICMonitorBlock *mb = &__MICMonitor[chan];
+		
+		if (!mb->is_open)
+			return MIC_RESULT_INVALID_STATE;
+		
+		u32 level = IRQ_Disable();
+		
+		const u32 first = mb->read;
+		if (count > mb->write - mb->read)
+		{
+			count = mb->write - mb->read;
+			mb->stats.underruns++;
+		}
+		mb->read += count;
+		mb->tail += count;
+		if (mb->tail >= mb->samples)
+			mb->tail -= mb->samples;
+		
+		// Oldest recent block that the first sample belongs to
+		u32 i;
+		for (i = 0; count && i < MIC_MONITOR_RECORDS; i++)
+		{
+			const u32 r = (mb->record_head + i) % MIC_MONITOR_RECORDS;
+			const u32 ahead = mb->record_end[r] - first;
+			if (ahead == 0 || ahead > mb->write - first)
+				continue;
+			
+			// Its last sample was captured at record_tick; step back to the
+			// first consumed sample
+			const u32 captured = mb->record_tick[r] - (u32)(((u64)(ahead - 1) * mb->ticks_per_out) >> 16);
+			const u32 latency = tick - captured;
+			
+			mb->stats.latency_last = latency;
+			if (latency < mb->stats.latency_min)
+				mb->stats.latency_min = latency;
+			if (latency > mb->stats.latency_max)
+				mb->stats.latency_max = latency;
+			if (mb->stats.latency_avg == 0)
+				mb->stats.latency_avg = latency;
+			else
+				mb->stats.latency_avg += ((s32)(latency - mb->stats.latency_avg)) / 16;
+			break;
+		}
+		
+		IRQ_Restore(level);
+		
+		result = MIC_RESULT_READY;
+	}
+	
+	return result;
+}
+
+s32 MICMonitorGetStats(s32 chan, MICMonitorStats* stats)
+{
+	s32 result = MIC_RESULT_FATAL_ERROR;
+	
+	if (chan >= 0 && chan <= 1 &&
+		stats != NULL)
+	{
+		struct MICMonitorBlock *mb = &__MICMonitor[chan];
+		
+		if (!mb->is_open)
+			return MIC_RESULT_INVALID_STATE;
+		
+		u32 level = IRQ_Disable();
+		*stats = mb->stats;
+		IRQ_Restore(level);
+		
+		if (stats->latency_min == (u32)~0)
+			stats->latency_min = 0;
+		
+		result = MIC_RESULT_READY;
+	}
+	
+	return result;
+}
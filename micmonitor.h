@@ -0,0 +1,44 @@
+#ifndef __MICMONITOR_H__
+#define __MICMONITOR_H__
+
+#include "mic.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Monitoring loopback: every completed hw block is resampled to the output
+// rate and appended to a caller-provided ring straight from the DMA
+// completion, for the audio mixer to play back.
+#define MIC_MONITOR_RECORDS            16   // recent blocks kept for latency lookup
+
+typedef struct _MICMonitorStats
+{
+	u32 latency_last;       // ticks from capture to playback, see MICMonitorConsume
+	u32 latency_min;
+	u32 latency_max;
+	u32 latency_avg;        // smoothed over roughly the last 16 measurements
+	u32 fill;               // output samples queued after the last block
+	u32 step;               // current resampling step, Q16 input samples per output sample
+	u32 overruns;           // blocks dropped because the ring was too full
+	u32 underruns;          // MICMonitorConsume calls that asked for more than was queued
+} MICMonitorStats;
+
+// Start looping chan back into ring (samples long) at out_rate. The
+// resampler trims its rate by up to 0.5% to hold the queue near target_ms.
+// The ring is written with the CPU; flush it before handing it to DMA.
+s32 MICMonitorOpen(s32 chan, s16* ring, u32 samples, u32 out_rate, u32 target_ms);
+s32 MICMonitorClose(s32 chan);
+// Samples queued in the ring, and the ring index of the oldest.
+s32 MICMonitorGetQueued(s32 chan, u32* index);
+// The mixer took count samples starting at the MICMonitorGetQueued index,
+// and the first of them starts playing at tick. Measures the loopback
+// latency of that sample. Safe from interrupt context.
+s32 MICMonitorConsume(s32 chan, u32 count, u32 tick);
+s32 MICMonitorGetStats(s32 chan, MICMonitorStats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,292 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <ogcsys.h>
+
+#include "processor.h"
+#include "lwp_watchdog.h"
+
+#include "mic.h"
+#include "micspectrum.h"
+#include "miconset.h"
+
+
+// Magnitudes are scaled so a full scale sine is 1, then compressed with
+// log(1 + MIC_ONSET_COMPRESSION * |X|) before differencing
+#define MIC_ONSET_COMPRESSION	100.f
+// Flux always needed for an event, so near-silence doesn't trigger on noise
+#define MIC_ONSET_FLOOR			0.02f
+// Short-term energy span used to place the onset inside the window
+#define MIC_ONSET_SPAN			32
+
+// The queue has one producer (the spectrum thread) and one reader, on a
+// single core; the index update only has to stay behind the entry itself.
+#define __MICOnsetBarrier()		__asm__ __volatile__("" ::: "memory")
+
+
+struct MICOnsetBlock
+{
+	BOOL is_open;
+	BOOL owns_spectrum;
+	
+	f32 sensitivity;
+	
+	BOOL has_prev;
+	f32 prev_mag[MIC_SPECTRUM_BINS];
+	
+	f32 history[MIC_ONSET_HISTORY];
+	f32 history_sum;
+	u32 history_count;
+	u32 history_index;
+	
+	BOOL armed;
+	BOOL has_last;
+	u64 last_position;
+	
+	MICOnset queue[MIC_ONSET_QUEUE];
+	volatile u32 head;
+	volatile u32 tail;
+	u32 dropped;
+} static __MICOnset[2];
+
+
+static void __MICOnsetFrame(s32 chan, const MICSpectrumFrame *frame, const s16 *window, u32 length);
+static void __MICOnsetDetect(struct MICOnsetBlock *ob, const MICSpectrumFrame *frame, const s16 *window, u32 length);
+static u32 __MICOnsetLocate(const s16 *x, u32 length, u32 first);
+static void __MICOnsetPush(struct MICOnsetBlock *ob, const MICOnset *event);
+
+
+static void __MICOnsetFrame(s32 chan, const MICSpectrumFrame *frame, const s16 *window, u32 length)
+{
+	struct MICOnsetBlock *ob = &__MICOnset[chan];
+	
+	if (ob->is_open)
+		__MICOnsetDetect(ob, frame, window, length);
+}
+
+static void __MICOnsetDetect(struct MICOnsetBlock *ob, const MICSpectrumFrame *frame, const s16 *window, u32 length)
+{
+	const f32 scale = MIC_ONSET_COMPRESSION * 4.f / length;
+	f32 flux = 0.f;
+	u32 k;
+	
+	for (k = 0; k < MIC_SPECTRUM_BINS; k++)
+	{
+		f32 mag = log1pf(scale * sqrtf(frame->power[k]));
+		if (ob->has_prev && mag > ob->prev_mag[k])
+			flux += mag - ob->prev_mag[k];
+		ob->prev_mag[k] = mag;
+	}
+	flux /= MIC_SPECTRUM_BINS;
+	
+	if (!ob->has_prev)
+	{
+		ob->has_prev = TRUE;
+		return;
+	}
+	
+	if (ob->history_count == MIC_ONSET_HISTORY)
+	{
+		const f32 threshold = MIC_ONSET_FLOOR + ob->sensitivity * ob->history_sum / MIC_ONSET_HISTORY;
+		
+		if (flux <= threshold)
+			ob->armed = TRUE;
+		else if (ob->armed)
+		{
+			ob->armed = FALSE;
+			
+			const u32 rate = (u32)(frame->bin_hz * MIC_SPECTRUM_FFT + 0.5f);
+			const u64 start = frame->position - length;
+			const u64 gap = (u64)rate * MIC_ONSET_MIN_GAP / 1000;
+			
+			// Only look past the end of the last event's dead time
+			u32 first = 0;
+			if (ob->has_last && ob->last_position + gap > start)
+				first = (ob->last_position + gap - start < length) ? (u32)(ob->last_position + gap - start) : length;
+			
+			if (first < length)
+			{
+				const u32 i = __MICOnsetLocate(window, length, first);
+				
+				MICOnset event;
+				event.position = start + i;
+				event.tick = frame->tick - (u32)((u64)(length - 1 - i) * TB_TIMER_CLOCK * 1000 / rate);
+				event.strength = flux;
+				__MICOnsetPush(ob, &event);
+				
+				ob->has_last = TRUE;
+				ob->last_position = event.position;
+			}
+		}
+		
+		ob->history_sum -= ob->history[ob->history_index];
+	}
+	else
+		ob->history_count++;
+	
+	ob->history[ob->history_index] = flux;
+	ob->history_sum += flux;
+	if (++ob->history_index == MIC_ONSET_HISTORY)
+		ob->history_index = 0;
+}
+
+// Index of the sample at which the mean energy of the MIC_ONSET_SPAN
+// samples after it rises the most over the MIC_ONSET_SPAN before it. A
+// shared spectrum may have a window of only a few samples, so the span
+// shrinks with it but never below one.
+static u32 __MICOnsetLocate(const s16 *x, u32 length, u32 first)
+{
+	u32 span = (length >= 4 * MIC_ONSET_SPAN) ? MIC_ONSET_SPAN : length / 4;
+	if (span == 0)
+		span = 1;
+	u64 before = 0;
+	u64 after = 0;
+	u32 i;
+	
+	if (first < span)
+		first = span;
+	if (first >= length)
+		return length - 1;
+	
+	for (i = first - span; i < first; i++)
+		before += x[i] * x[i];
+	for (i = first; i < first + span && i < length; i++)
+		after += x[i] * x[i];
+	
+	u32 best = first;
+	f32 best_ratio = -1.f;
+	
+	for (i = first; i < length; i++)
+	{
+		const u32 end = (i + span < length) ? i + span : length;
+		const f32 ratio = ((f32)after / (end - i)) / ((f32)before / span + 1.f);
+		if (ratio > best_ratio)
+		{
+			best_ratio = ratio;
+			best = i;
+		}
+		
+		before += x[i] * x[i];
+		before -= x[i - span] * x[i - span];
+		after -= x[i] * x[i];
+		if (i + span < length)
+			after += x[i + span] * x[i + span];
+	}
+	
+	return best;
+}
+
+static void __MICOnsetPush(struct MICOnsetBlock *ob, const MICOnset *event)
+{
+	const u32 head = ob->head;
+	
+	if (head - ob->tail >= MIC_ONSET_QUEUE)
+	{
+		ob->dropped++;
+		return;
+	}
+	
+	ob->queue[head % MIC_ONSET_QUEUE] = *event;
+	__MICOnsetBarrier();
+	ob->head = head + 1;
+}
+
+s32 MICOnsetOpen(s32 chan, f32 sensitivity)
+{
+	s32 result = MIC_RESULT_FATAL_ERROR;
+	
+	if (chan >= 0 && chan <= 1 &&
+		sensitivity > 0.f)
+	{
+		struct MICOnsetBlock *ob = &__MICOnset[chan];
+		
+		if (ob->is_open)
+			return MIC_RESULT_INVALID_STATE;
+		
+		ob->sensitivity = sensitivity;
+		ob->has_prev = FALSE;
+		ob->history_sum = 0.f;
+		ob->history_count = 0;
+		ob->history_index = 0;
+		ob->armed = FALSE;
+		ob->has_last = FALSE;
+		ob->head = 0;
+		ob->tail = 0;
+		ob->dropped = 0;
+		
+		// Share the spectrum stage if something else already runs it
+		result = MICSpectrumOpen(chan, MIC_ONSET_WINDOW, MIC_ONSET_HOP);
+		if (result == MIC_RESULT_READY)
+			ob->owns_spectrum = TRUE;
+		else if (result == MIC_RESULT_INVALID_STATE)
+			ob->owns_spectrum = FALSE;
+		else
+			return result;
+		
+		u32 level = IRQ_Disable();
+		if ((result = MICSpectrumAddListener(chan, __MICOnsetFrame)) >= MIC_RESULT_READY)
+			ob->is_open = TRUE;
+		IRQ_Restore(level);
+		
+		if (result < MIC_RESULT_READY && ob->owns_spectrum)
+			MICSpectrumClose(chan);
+	}
+	
+	return result;
+}
+
+s32 MICOnsetClose(s32 chan)
+{
+	s32 result = MIC_RESULT_FATAL_ERROR;
+	
+	if (chan >= 0 && chan <= 1)
+	{
+		struct MICOnsetBlock *ob = &__MICOnset[chan];
+		
+		if (!ob->is_open)
+			return MIC_RESULT_INVALID_STATE;
+		
+		u32 level = IRQ_Disable();
+		MICSpectrumRemoveListener(chan, __MICOnsetFrame);
+		ob->is_open = FALSE;
+		IRQ_Restore(level);
+		
+		if (ob->owns_spectrum)
+			MICSpectrumClose(chan);
+		
+		result = MIC_RESULT_READY;
+	}
+	
+	return result;
+}
+
+s32 MICOnsetRead(s32 chan, MICOnset* events, s32 max)
+{
+	s32 count = 0;
+	
+	if (chan >= 0 && chan <= 1 &&
+		events != NULL)
+	{
+		struct MICOnsetBlock *ob = &__MICOnset[chan];
+		const u32 head = ob->head;
+		u32 tail = ob->tail;
+		
+		__MICOnsetBarrier();
+		
+		while (tail != head && count < max)
+			events[count++] = ob->queue[tail++ % MIC_ONSET_QUEUE];
+		
+		__MICOnsetBarrier();
+		ob->tail = tail;
+	}
+	
+	return count;
+}
+
+u32 MICOnsetGetDropped(s32 chan)
+{
+	if (chan >= 0 && chan <= 1)
+		return __MICOnset[chan].dropped;
+	else
+		return 0;
+}
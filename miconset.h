@@ -0,0 +1,44 @@
+#ifndef __MICONSET_H__
+#define __MICONSET_H__
+
+#include "mic.h"
+#include "micspectrum.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Spectral-flux onset (clap/shout) detector on top of the spectrum stage.
+// A frame whose flux rises past an adaptive threshold is localised to the
+// sample inside its window where short-term energy jumps the most.
+#define MIC_ONSET_WINDOW              512   // spectrum window if MICOnsetOpen opens it
+#define MIC_ONSET_HOP                 128
+#define MIC_ONSET_QUEUE                64   // events held for MICOnsetRead
+#define MIC_ONSET_HISTORY              16   // frames averaged for the threshold
+#define MIC_ONSET_MIN_GAP              50   // ms between events
+#define MIC_ONSET_SENSITIVITY        2.0f   // default threshold, x mean recent flux
+
+typedef struct _MICOnset
+{
+	u64 position;       // stream position of the onset sample, see MICGetPosition
+	u32 tick;           // timebase tick that sample was captured at
+	f32 strength;       // spectral flux, mean log-magnitude rise per bin
+} MICOnset;
+
+// Start detecting onsets on a mounted channel. Uses the channel's spectrum
+// stage if it is already open, otherwise opens one with MIC_ONSET_WINDOW
+// and MIC_ONSET_HOP (and closes it again in MICOnsetClose). Higher
+// sensitivity values need a larger jump over the recent flux.
+s32 MICOnsetOpen(s32 chan, f32 sensitivity);
+s32 MICOnsetClose(s32 chan);
+// Copy out up to max events, oldest first. Returns the number copied.
+// Single reader; does not block the detector.
+s32 MICOnsetRead(s32 chan, MICOnset* events, s32 max);
+// Events discarded because MICOnsetRead fell behind.
+u32 MICOnsetGetDropped(s32 chan);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
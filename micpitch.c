@@ -0,0 +1,425 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ogcsys.h>
+
+#include "processor.h"
+#include "lwp.h"
+#include "lwp_watchdog.h"
+#include "semaphore.h"
+
+#include "mic.h"
+#include "micpitch.h"
+
+
+#define MIC_PITCH_STACK_SIZE	8*1024
+#define MIC_PITCH_PRIORITY		70
+
+// Decimated history, mirrored so the lag loop never wraps. Must be a power
+// of two larger than MIC_PITCH_WINDOW_MAX + MIC_PITCH_LAG_MAX.
+#define MIC_PITCH_HISTORY		2048
+
+
+struct MICPitchBlock
+{
+	BOOL is_open;
+	volatile BOOL is_running;
+	
+	lwp_t thread;
+	sem_t wake_sem;
+	u8 thread_stack[MIC_PITCH_STACK_SIZE] ATTRIBUTE_ALIGN(8);
+	
+	u32 input_rate;
+	u32 decimate;
+	u32 window;
+	u32 hop;
+	u32 lag_min;
+	u32 lag_max;
+	
+	// Driver ring as of the last pass; a swap resyncs the read position
+	s16 *ring_base;
+	s32 ring_samples;
+	s32 read_index;
+	
+	// Top and time of the newest block, from the tx callback
+	volatile s32 block_top;
+	volatile u32 block_tick;
+	
+	u64 position;
+	s32 dec_sum;
+	u32 dec_count;
+	u32 hop_count;
+	
+	// diff[tau] is the YIN difference function over the last window
+	// analysis samples, updated as each one arrives rather than recomputed
+	// per hop. Terms are exact integers, so the running sums never drift.
+	u32 count;
+	s16 history[2 * MIC_PITCH_HISTORY];
+	f64 diff[MIC_PITCH_LAG_MAX + 1];
+	f32 cmnd[MIC_PITCH_LAG_MAX + 1];
+	
+	MICPitch results[MIC_PITCH_QUEUE];
+	u32 result_head;
+	u32 result_count;
+	u32 dropped;
+	u32 skipped;
+} static __MICPitch[2];
+
+
+static void __MICPitchTxCallback(s32 chan, s32 result);
+static void* __MICPitchThread(void *arg);
+static void __MICPitchProcess(s32 chan);
+static void __MICPitchPush(struct MICPitchBlock *pb, s16 x);
+static void __MICPitchEstimate(struct MICPitchBlock *pb, MICPitch *result);
+static void __MICPitchQueue(struct MICPitchBlock *pb, const MICPitch *result);
+
+
+static void __MICPitchTxCallback(s32 chan, s32 result)
+{
+	struct MICPitchBlock *pb = &__MICPitch[chan];
+	
+	// Added before read_index is set; is_open says it has been
+	if (pb->is_open && pb->is_running && result >= MIC_RESULT_READY)
+	{
+		pb->block_top = MICGetCurrentTop(chan);
+		pb->block_tick = gettick();
+		LWP_SemPost(pb->wake_sem);
+	}
+}
+
+static void* __MICPitchThread(void *arg)
+{
+	s32 chan = (s32)arg;
+	struct MICPitchBlock *pb = &__MICPitch[chan];
+	
+	for (;;)
+	{
+		LWP_SemWait(pb->wake_sem);
+		
+		if (!pb->is_running)
+			break;
+		
+		__MICPitchProcess(chan);
+	}
+	
+	return NULL;
+}
+
+static void __MICPitchProcess(s32 chan)
+{
+	struct MICPitchBlock *pb = &__MICPitch[chan];
+	
+	s16 *base;
+	s32 size;
+	if (MICGetRingbuff(chan, &base) < MIC_RESULT_READY ||
+		MICGetRingbuffsize(chan, &size) < MIC_RESULT_READY)
+		return;
+	
+	u32 level = IRQ_Disable();
+	const s32 top = pb->block_top;
+	const u32 tick = pb->block_tick;
+	IRQ_Restore(level);
+	
+	const s32 samples_in_ring = size / sizeof(s16);
+	if (top < 0 || top >= samples_in_ring)
+		return;
+	
+	if (base != pb->ring_base || samples_in_ring != pb->ring_samples)
+	{
+		pb->ring_base = base;
+		pb->ring_samples = samples_in_ring;
+		pb->read_index = top;
+		return;
+	}
+	
+	s32 behind = top - pb->read_index;
+	if (behind < 0)
+		behind += samples_in_ring;
+	
+	// Too close to being overwritten to trust; pick up from the top
+	if (behind > samples_in_ring / 2)
+	{
+		pb->position += behind;
+		pb->read_index = top;
+		pb->skipped += behind;
+		return;
+	}
+	
+	while (behind)
+	{
+		s16 x = base[pb->read_index];
+		if (++pb->read_index == samples_in_ring)
+			pb->read_index = 0;
+		behind--;
+		
+		pb->position++;
+		pb->dec_sum += x;
+		if (++pb->dec_count < pb->decimate)
+			continue;
+		
+		// Box-filter down to MIC_PITCH_RATE, and drop a bit so squared
+		// differences fit in s32
+		s16 y = pb->dec_sum / (s32)(2 * pb->decimate);
+		pb->dec_sum = 0;
+		pb->dec_count = 0;
+		
+		__MICPitchPush(pb, y);
+		
+		if (++pb->hop_count == pb->hop)
+		{
+			pb->hop_count = 0;
+			
+			// Nothing to report until the window and every lag are full
+			if (pb->count >= pb->window + pb->lag_max)
+			{
+				MICPitch result;
+				__MICPitchEstimate(pb, &result);
+				result.position = pb->position;
+				result.tick = tick - (u32)((u64)behind * TB_TIMER_CLOCK * 1000 / pb->input_rate);
+				__MICPitchQueue(pb, &result);
+			}
+		}
+	}
+}
+
+static void __MICPitchPush(struct MICPitchBlock *pb, s16 x)
+{
+	u32 i = pb->count & (MIC_PITCH_HISTORY - 1);
+	pb->history[i] = x;
+	pb->history[i + MIC_PITCH_HISTORY] = x;
+	
+	// now[-tau] is the sample tau back, old[-tau] the one tau back from the
+	// sample leaving the window
+	const s16 *now = &pb->history[i + MIC_PITCH_HISTORY];
+	const s16 *old = now - pb->window;
+	const s32 a = x;
+	const s32 b = old[0];
+	f64 *diff = pb->diff;
+	
+	u32 tau;
+	for (tau = 1; tau <= pb->lag_max; tau++)
+	{
+		s32 da = now[-(s32)tau] - a;
+		s32 db = old[-(s32)tau] - b;
+		diff[tau] += (f64)(da * da - db * db);
+	}
+	
+	pb->count++;
+}
+
+static void __MICPitchEstimate(struct MICPitchBlock *pb, MICPitch *result)
+{
+	const u32 lag_min = pb->lag_min;
+	const u32 lag_max = pb->lag_max;
+	f32 *cmnd = pb->cmnd;
+	f64 sum = 0.;
+	u32 tau;
+	
+	// Cumulative mean normalised difference
+	cmnd[0] = 1.f;
+	for (tau = 1; tau <= lag_max; tau++)
+	{
+		sum += pb->diff[tau];
+		cmnd[tau] = (sum > 0.) ? (f32)(pb->diff[tau] * tau / sum) : 1.f;
+	}
+	
+	// The first dip under the threshold, followed down to its minimum; with
+	// none, the best lag overall marks the frame unvoiced
+	BOOL voiced = FALSE;
+	u32 best = lag_min;
+	for (tau = lag_min; tau <= lag_max; tau++)
+	{
+		if (cmnd[tau] < MIC_PITCH_THRESHOLD)
+		{
+			while (tau < lag_max && cmnd[tau + 1] < cmnd[tau])
+				tau++;
+			best = tau;
+			voiced = TRUE;
+			break;
+		}
+		if (cmnd[tau] < cmnd[best])
+			best = tau;
+	}
+	
+	// Parabolic interpolation between neighbouring lags
+	f32 period = best;
+	if (best > lag_min && best < lag_max)
+	{
+		f32 l = cmnd[best - 1];
+		f32 c = cmnd[best];
+		f32 r = cmnd[best + 1];
+		f32 den = l - 2.f * c + r;
+		if (den > 0.f)
+			period += 0.5f * (l - r) / den;
+	}
+	
+	f32 confidence = 1.f - cmnd[best];
+	if (confidence < 0.f)
+		confidence = 0.f;
+	
+	result->frequency = voiced ? MIC_PITCH_RATE / period : 0.f;
+	result->confidence = confidence;
+}
+
+static void __MICPitchQueue(struct MICPitchBlock *pb, const MICPitch *result)
+{
+	u32 level = IRQ_Disable();
+	
+	if (pb->result_count == MIC_PITCH_QUEUE)
+	{
+		pb->result_head = (pb->result_head + 1) % MIC_PITCH_QUEUE;
+		pb->result_count--;
+		pb->dropped++;
+	}
+	
+	pb->results[(pb->result_head + pb->result_count) % MIC_PITCH_QUEUE] = *result;
+	pb->result_count++;
+	
+	IRQ_Restore(level);
+}
+
+s32 MICPitchOpen(s32 chan, u32 min_hz, u32 max_hz, u32 window, u32 hop)
+{
+	s32 result = MIC_RESULT_FATAL_ERROR;
+	
+	if (chan >= 0 && chan <= 1 &&
+		min_hz > 0 && max_hz > min_hz &&
+		window > 0 && window <= MIC_PITCH_WINDOW_MAX &&
+		hop > 0 && hop <= window)
+	{
+		struct MICPitchBlock *pb = &__MICPitch[chan];
+		
+		u32 lag_min = MIC_PITCH_RATE / max_hz;
+		u32 lag_max = (MIC_PITCH_RATE + min_hz - 1) / min_hz;
+		if (lag_min < 2 || lag_max > MIC_PITCH_LAG_MAX)
+			return MIC_RESULT_FATAL_ERROR;
+		
+		if (pb->is_open)
+			return MIC_RESULT_INVALID_STATE;
+		
+		s32 rate;
+		if ((result = MICGetRate(chan, &rate)) < MIC_RESULT_READY)
+			return result;
+		
+		s32 size;
+		if ((result = MICGetRingbuff(chan, &pb->ring_base)) < MIC_RESULT_READY ||
+			(result = MICGetRingbuffsize(chan, &size)) < MIC_RESULT_READY)
+			return result;
+		
+		pb->input_rate = rate;
+		pb->decimate = rate / MIC_PITCH_RATE;
+		pb->window = window;
+		pb->hop = hop;
+		pb->lag_min = lag_min;
+		pb->lag_max = lag_max;
+		pb->ring_samples = size / sizeof(s16);
+		pb->position = 0;
+		pb->dec_sum = 0;
+		pb->dec_count = 0;
+		pb->hop_count = 0;
+		pb->count = 0;
+		pb->result_head = 0;
+		pb->result_count = 0;
+		pb->dropped = 0;
+		pb->skipped = 0;
+		memset(pb->history, 0, sizeof(pb->history));
+		memset(pb->diff, 0, sizeof(pb->diff));
+		
+		if ((result = MICAddTxListener(chan, __MICPitchTxCallback)) < MIC_RESULT_READY)
+			return result;
+		
+		if (LWP_SemInit(&pb->wake_sem, 0, 1) < 0)
+		{
+			MICRemoveTxListener(chan, __MICPitchTxCallback);
+			return MIC_RESULT_FATAL_ERROR;
+		}
+		
+		pb->is_running = TRUE;
+		
+		if (LWP_CreateThread(&pb->thread, __MICPitchThread, (void*)chan,
+			pb->thread_stack, MIC_PITCH_STACK_SIZE, MIC_PITCH_PRIORITY) < 0)
+		{
+			pb->is_running = FALSE;
+			LWP_SemDestroy(pb->wake_sem);
+			MICRemoveTxListener(chan, __MICPitchTxCallback);
+			return MIC_RESULT_FATAL_ERROR;
+		}
+		
+		u32 level = IRQ_Disable();
+		pb->read_index = MICGetCurrentTop(chan);
+		pb->block_top = pb->read_index;
+		pb->block_tick = gettick();
+		pb->is_open = TRUE;
+		IRQ_Restore(level);
+		
+		result = MIC_RESULT_READY;
+	}
+	
+	return result;
+}
+
+s32 MICPitchClose(s32 chan)
+{
+	s32 result = MIC_RESULT_FATAL_ERROR;
+	
+	if (chan >= 0 && chan <= 1)
+	{
+		struct MICPitchBlock *pb = &__MICPitch[chan];
+		
+		if (!pb->is_open)
+			return MIC_RESULT_INVALID_STATE;
+		
+		u32 level = IRQ_Disable();
+		MICRemoveTxListener(chan, __MICPitchTxCallback);
+		pb->is_running = FALSE;
+		IRQ_Restore(level);
+		
+		LWP_SemPost(pb->wake_sem);
+		LWP_JoinThread(pb->thread, NULL);
+		LWP_SemDestroy(pb->wake_sem);
+		
+		pb->is_open = FALSE;
+		result = MIC_RESULT_READY;
+	}
+	
+	return result;
+}
+
+s32 MICPitchRead(s32 chan, MICPitch* results, s32 max)
+{
+	s32 result = MIC_RESULT_FATAL_ERROR;
+	
+	if (chan >= 0 && chan <= 1 &&
+		results != NULL &&
+		max >= 0)
+	{
+		struct MICPitchBlock *pb = &__MICPitch[chan];
+		u32 level = IRQ_Disable();
+		
+		for (result = 0; result < max && pb->result_count; result++)
+		{
+			results[result] = pb->results[pb->result_head];
+			pb->result_head = (pb->result_head + 1) % MIC_PITCH_QUEUE;
+			pb->result_count--;
+		}
+		
+		IRQ_Restore(level);
+	}
+	
+	return result;
+}
+
+u32 MICPitchGetDropped(s32 chan)
+{
+	if (chan >= 0 && chan <= 1)
+		return __MICPitch[chan].dropped;
+	else
+		return 0;
+}
+
+u32 MICPitchGetSkipped(s32 chan)
+{
+	if (chan >= 0 && chan <= 1)
+		return __MICPitch[chan].skipped;
+	else
+		return 0;
+}
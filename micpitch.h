@@ -0,0 +1,47 @@
+#ifndef __MICPITCH_H__
+#define __MICPITCH_H__
+
+#include "mic.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Streaming YIN pitch detector. Input is decimated to MIC_PITCH_RATE, which
+// covers the singing range with room to spare and keeps the per-sample cost
+// down at 44100Hz.
+#define MIC_PITCH_RATE               11025
+#define MIC_PITCH_WINDOW_MAX          1024   // analysis samples
+#define MIC_PITCH_LAG_MAX              512   // lowest pitch = MIC_PITCH_RATE / lag
+#define MIC_PITCH_QUEUE                 32   // results held for MICPitchRead
+
+// Cumulative mean normalised difference below which a lag counts as the
+// period. Lower is stricter.
+#define MIC_PITCH_THRESHOLD          0.15f
+
+typedef struct _MICPitch
+{
+	u64 position;       // input samples since MICPitchOpen at the end of the window
+	u32 tick;           // timebase tick that sample was captured at
+	f32 frequency;      // Hz, 0 if no period was found (unvoiced)
+	f32 confidence;     // 0..1
+} MICPitch;
+
+// Start tracking pitch on a mounted channel between min_hz and max_hz,
+// producing one result every hop analysis samples over a window of window
+// analysis samples. Analysis runs on its own thread, reading new blocks
+// straight out of the driver ringbuffer. Reopen after changing the rate.
+s32 MICPitchOpen(s32 chan, u32 min_hz, u32 max_hz, u32 window, u32 hop);
+s32 MICPitchClose(s32 chan);
+// Copy out up to max results, oldest first. Returns the number copied.
+s32 MICPitchRead(s32 chan, MICPitch* results, s32 max);
+// Results discarded because MICPitchRead fell behind, and input skipped
+// because analysis fell more than half a ring behind the driver.
+u32 MICPitchGetDropped(s32 chan);
+u32 MICPitchGetSkipped(s32 chan);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
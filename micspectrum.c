@@ -0,0 +1,501 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <ogcsys.h>
+
+#include "processor.h"
+#include "lwp.h"
+#include "lwp_watchdog.h"
+#include "semaphore.h"
+
+#include "mic.h"
+#include "micspectrum.h"
+
+
+#define MIC_SPECTRUM_STACK_SIZE	8*1024
+#define MIC_SPECTRUM_PRIORITY	70
+
+// The real FFT runs as a complex FFT of half the size
+#define MIC_SPECTRUM_HALF		(MIC_SPECTRUM_FFT / 2)
+
+// Readers and the producer are threads on a single core; a slot's seq only
+// has to be ordered against its contents by the compiler.
+#define __MICSpectrumBarrier()	__asm__ __volatile__("" ::: "memory")
+
+// Frame listeners per channel, see MICSpectrumAddListener
+#define MIC_SPECTRUM_LISTENERS	4
+
+
+struct MICSpectrumBlock
+{
+	BOOL is_open;
+	volatile BOOL is_running;
+	
+	lwp_t thread;
+	sem_t wake_sem;
+	u8 thread_stack[MIC_SPECTRUM_STACK_SIZE] ATTRIBUTE_ALIGN(8);
+	
+	MICSpectrumCallback listeners[MIC_SPECTRUM_LISTENERS];
+	u32 listener_count;
+	
+	u32 input_rate;
+	u32 window;
+	u32 hop;
+	
+	// Driver ring as of the last pass; a swap resyncs the read position
+	s16 *ring_base;
+	s32 ring_samples;
+	s32 read_index;
+	
+	// Top and time of the newest block, from the tx callback
+	volatile s32 block_top;
+	volatile u32 block_tick;
+	volatile u64 block_pos;
+	
+	// Stream position of the next sample read, see MICGetPosition
+	u64 position;
+	u32 count;
+	u32 hop_count;
+	
+	// Input history, mirrored so a window is always contiguous
+	s16 history[2 * MIC_SPECTRUM_FFT];
+	
+	f32 win[MIC_SPECTRUM_FFT];
+	f32 re[MIC_SPECTRUM_HALF];
+	f32 im[MIC_SPECTRUM_HALF];
+	u16 bitrev[MIC_SPECTRUM_HALF];
+	f32 fft_cos[MIC_SPECTRUM_HALF / 2];
+	f32 fft_sin[MIC_SPECTRUM_HALF / 2];
+	f32 split_cos[MIC_SPECTRUM_HALF];
+	f32 split_sin[MIC_SPECTRUM_HALF];
+	
+	// Each slot's seq is zeroed while it is rewritten, so a reader that sees
+	// the same non-zero seq before and after its copy got a whole frame
+	MICSpectrumFrame frames[MIC_SPECTRUM_FRAMES];
+	volatile u32 latest;
+} static __MICSpectrum[2];
+
+
+static void __MICSpectrumTxCallback(s32 chan, s32 result);
+static void* __MICSpectrumThread(void *arg);
+static void __MICSpectrumProcess(s32 chan);
+static void __MICSpectrumCompute(struct MICSpectrumBlock *sb, f32 *power);
+static void __MICSpectrumPublish(s32 chan, u32 tick);
+static void __MICSpectrumTables(struct MICSpectrumBlock *sb);
+
+
+static void __MICSpectrumTxCallback(s32 chan, s32 result)
+{
+	struct MICSpectrumBlock *sb = &__MICSpectrum[chan];
+	
+	// Added before read_index is set; is_open says it has been
+	if (sb->is_open && sb->is_running && result >= MIC_RESULT_READY)
+	{
+		sb->block_top = MICGetCurrentTop(chan);
+		sb->block_tick = gettick();
+		MICGetPosition(chan, (u64*)&sb->block_pos);
+		LWP_SemPost(sb->wake_sem);
+	}
+}
+
+static void* __MICSpectrumThread(void *arg)
+{
+	s32 chan = (s32)arg;
+	struct MICSpectrumBlock *sb = &__MICSpectrum[chan];
+	
+	for (;;)
+	{
+		LWP_SemWait(sb->wake_sem);
+		
+		if (!sb->is_running)
+			break;
+		
+		__MICSpectrumProcess(chan);
+	}
+	
+	return NULL;
+}
+
+static void __MICSpectrumProcess(s32 chan)
+{
+	struct MICSpectrumBlock *sb = &__MICSpectrum[chan];
+	
+	s16 *base;
+	s32 size;
+	if (MICGetRingbuff(chan, &base) < MIC_RESULT_READY ||
+		MICGetRingbuffsize(chan, &size) < MIC_RESULT_READY)
+		return;
+	
+	u32 level = IRQ_Disable();
+	const s32 top = sb->block_top;
+	const u32 tick = sb->block_tick;
+	const u64 pos = sb->block_pos;
+	IRQ_Restore(level);
+	
+	const s32 samples_in_ring = size / sizeof(s16);
+	if (top < 0 || top >= samples_in_ring)
+		return;
+	
+	if (base != sb->ring_base || samples_in_ring != sb->ring_samples)
+	{
+		sb->ring_base = base;
+		sb->ring_samples = samples_in_ring;
+		sb->read_index = top;
+		return;
+	}
+	
+	s32 behind = top - sb->read_index;
+	if (behind < 0)
+		behind += samples_in_ring;
+	
+	// Too close to being overwritten to trust; pick up from the top. The
+	// skipped samples need no accounting, as position is taken afresh from
+	// the driver's below.
+	if (behind > samples_in_ring / 2)
+	{
+		sb->read_index = top;
+		return;
+	}
+	
+	// Stamp from the driver's stream position of the block's top, so frames
+	// stay on MICGetPosition numbering across skips, swaps and restarts
+	sb->position = pos - behind;
+	
+	while (behind)
+	{
+		s16 x = base[sb->read_index];
+		if (++sb->read_index == samples_in_ring)
+			sb->read_index = 0;
+		behind--;
+		
+		u32 i = sb->count & (MIC_SPECTRUM_FFT - 1);
+		sb->history[i] = x;
+		sb->history[i + MIC_SPECTRUM_FFT] = x;
+		sb->count++;
+		sb->position++;
+		
+		if (++sb->hop_count == sb->hop)
+		{
+			sb->hop_count = 0;
+			if (sb->count >= sb->window)
+				__MICSpectrumPublish(chan, tick - (u32)((u64)behind * TB_TIMER_CLOCK * 1000 / sb->input_rate));
+		}
+	}
+}
+
+static void __MICSpectrumPublish(s32 chan, u32 tick)
+{
+	struct MICSpectrumBlock *sb = &__MICSpectrum[chan];
+	const u32 seq = sb->latest + 1;
+	MICSpectrumFrame *frame = &sb->frames[seq % MIC_SPECTRUM_FRAMES];
+	
+	frame->seq = 0;
+	__MICSpectrumBarrier();
+	frame->tick = tick;
+	frame->position = sb->position;
+	frame->bin_hz = (f32)sb->input_rate / MIC_SPECTRUM_FFT;
+	__MICSpectrumCompute(sb, frame->power);
+	__MICSpectrumBarrier();
+	frame->seq = seq;
+	
+	sb->latest = seq;
+	
+	const s16 *window = &sb->history[(sb->count & (MIC_SPECTRUM_FFT - 1)) + MIC_SPECTRUM_FFT - sb->window];
+	u32 i;
+	for (i = 0; i < sb->listener_count; i++)
+		sb->listeners[i](chan, frame, window, sb->window);
+}
+
+static void __MICSpectrumCompute(struct MICSpectrumBlock *sb, f32 *power)
+{
+	f32 *re = sb->re;
+	f32 *im = sb->im;
+	u32 i;
+	
+	// Pack the windowed, zero-padded input as even/odd pairs of a half-size
+	// complex sequence, in bit-reversed order
+	const s16 *x = &sb->history[(sb->count & (MIC_SPECTRUM_FFT - 1)) + MIC_SPECTRUM_FFT - sb->window];
+	for (i = 0; i < MIC_SPECTRUM_HALF; i++)
+	{
+		u32 j = sb->bitrev[i];
+		re[j] = (2 * i < sb->window) ? x[2 * i] * sb->win[2 * i] : 0.f;
+		im[j] = (2 * i + 1 < sb->window) ? x[2 * i + 1] * sb->win[2 * i + 1] : 0.f;
+	}
+	
+	// Radix-2 decimation in time
+	u32 size;
+	for (size = 2; size <= MIC_SPECTRUM_HALF; size <<= 1)
+	{
+		const u32 half = size / 2;
+		const u32 step = MIC_SPECTRUM_HALF / size;
+		u32 start;
+		for (start = 0; start < MIC_SPECTRUM_HALF; start += size)
+		{
+			u32 j;
+			for (j = 0; j < half; j++)
+			{
+				const f32 wr = sb->fft_cos[j * step];
+				const f32 wi = -sb->fft_sin[j * step];
+				const u32 k = start + j;
+				const u32 l = k + half;
+				const f32 tr = wr * re[l] - wi * im[l];
+				const f32 ti = wr * im[l] + wi * re[l];
+				re[l] = re[k] - tr;
+				im[l] = im[k] - ti;
+				re[k] += tr;
+				im[k] += ti;
+			}
+		}
+	}
+	
+	// Separate the even and odd halves back into the real input's spectrum
+	power[0] = (re[0] + im[0]) * (re[0] + im[0]);
+	power[MIC_SPECTRUM_HALF] = (re[0] - im[0]) * (re[0] - im[0]);
+	for (i = 1; i < MIC_SPECTRUM_HALF; i++)
+	{
+		const u32 m = MIC_SPECTRUM_HALF - i;
+		const f32 er = 0.5f * (re[i] + re[m]);
+		const f32 ei = 0.5f * (im[i] - im[m]);
+		const f32 or = 0.5f * (im[i] + im[m]);
+		const f32 oi = -0.5f * (re[i] - re[m]);
+		const f32 c = sb->split_cos[i];
+		const f32 s = sb->split_sin[i];
+		const f32 xr = er + c * or + s * oi;
+		const f32 xi = ei + c * oi - s * or;
+		power[i] = xr * xr + xi * xi;
+	}
+}
+
+static void __MICSpectrumTables(struct MICSpectrumBlock *sb)
+{
+	u32 i;
+	
+	// Hann window over the analysis length, scaled to full scale = 1
+	for (i = 0; i < sb->window; i++)
+		sb->win[i] = (0.5f - 0.5f * cosf(2.f * M_PI * i / sb->window)) / 32768.f;
+	
+	u32 bits = 0;
+	while ((1u << bits) < MIC_SPECTRUM_HALF)
+		bits++;
+	for (i = 0; i < MIC_SPECTRUM_HALF; i++)
+	{
+		u32 r = 0;
+		u32 b;
+		for (b = 0; b < bits; b++)
+			r |= ((i >> b) & 1) << (bits - 1 - b);
+		sb->bitrev[i] = r;
+	}
+	
+	for (i = 0; i < MIC_SPECTRUM_HALF / 2; i++)
+	{
+		sb->fft_cos[i] = cosf(2.f * M_PI * i / MIC_SPECTRUM_HALF);
+		sb->fft_sin[i] = sinf(2.f * M_PI * i / MIC_SPECTRUM_HALF);
+	}
+	
+	for (i = 0; i < MIC_SPECTRUM_HALF; i++)
+	{
+		sb->split_cos[i] = cosf(2.f * M_PI * i / MIC_SPECTRUM_FFT);
+		sb->split_sin[i] = sinf(2.f * M_PI * i / MIC_SPECTRUM_FFT);
+	}
+}
+
+s32 MICSpectrumOpen(s32 chan, u32 window, u32 hop)
+{
+	s32 result = MIC_RESULT_FATAL_ERROR;
+	
+	if (chan >= 0 && chan <= 1 &&
+		window >= 2 && window <= MIC_SPECTRUM_FFT &&
+		hop > 0)
+	{
+		struct MICSpectrumBlock *sb = &__MICSpectrum[chan];
+		
+		if (sb->is_open)
+			return MIC_RESULT_INVALID_STATE;
+		
+		s32 rate;
+		if ((result = MICGetRate(chan, &rate)) < MIC_RESULT_READY)
+			return result;
+		
+		s32 size;
+		if ((result = MICGetRingbuff(chan, &sb->ring_base)) < MIC_RESULT_READY ||
+			(result = MICGetRingbuffsize(chan, &size)) < MIC_RESULT_READY)
+			return result;
+		
+		sb->input_rate = rate;
+		sb->window = window;
+		sb->hop = hop;
+		sb->ring_samples = size / sizeof(s16);
+		sb->count = 0;
+		sb->hop_count = 0;
+		sb->latest = 0;
+		memset(sb->frames, 0, sizeof(sb->frames));
+		memset(sb->history, 0, sizeof(sb->history));
+		__MICSpectrumTables(sb);
+		
+		if ((result = MICAddTxListener(chan, __MICSpectrumTxCallback)) < MIC_RESULT_READY)
+			return result;
+		
+		if (LWP_SemInit(&sb->wake_sem, 0, 1) < 0)
+		{
+			MICRemoveTxListener(chan, __MICSpectrumTxCallback);
+			return MIC_RESULT_FATAL_ERROR;
+		}
+		
+		sb->is_running = TRUE;
+		
+		if (LWP_CreateThread(&sb->thread, __MICSpectrumThread, (void*)chan,
+			sb->thread_stack, MIC_SPECTRUM_STACK_SIZE, MIC_SPECTRUM_PRIORITY) < 0)
+		{
+			sb->is_running = FALSE;
+			LWP_SemDestroy(sb->wake_sem);
+			MICRemoveTxListener(chan, __MICSpectrumTxCallback);
+			return MIC_RESULT_FATAL_ERROR;
+		}
+		
+		u32 level = IRQ_Disable();
+		sb->read_index = MICGetCurrentTop(chan);
+		sb->block_top = sb->read_index;
+		sb->block_tick = gettick();
+		MICGetPosition(chan, (u64*)&sb->block_pos);
+		sb->position = sb->block_pos;
+		sb->is_open = TRUE;
+		IRQ_Restore(level);
+		
+		result = MIC_RESULT_READY;
+	}
+	
+	return result;
+}
+
+s32 MICSpectrumClose(s32 chan)
+{
+	s32 result = MIC_RESULT_FATAL_ERROR;
+	
+	if (chan >= 0 && chan <= 1)
+	{
+		struct MICSpectrumBlock *sb = &__MICSpectrum[chan];
+		
+		if (!sb->is_open)
+			return MIC_RESULT_INVALID_STATE;
+		
+		u32 level = IRQ_Disable();
+		MICRemoveTxListener(chan, __MICSpectrumTxCallback);
+		sb->is_running = FALSE;
+		IRQ_Restore(level);
+		
+		LWP_SemPost(sb->wake_sem);
+		LWP_JoinThread(sb->thread, NULL);
+		LWP_SemDestroy(sb->wake_sem);
+		
+		sb->is_open = FALSE;
+		result = MIC_RESULT_READY;
+	}
+	
+	return result;
+}
+
+s32 MICSpectrumAddListener(s32 chan, MICSpectrumCallback listener)
+{
+	s32 result = MIC_RESULT_FATAL_ERROR;
+	
+	if (chan >= 0 && chan <= 1 &&
+		listener != NULL)
+	{
+		struct MICSpectrumBlock *sb = &__MICSpectrum[chan];
+		u32 level = IRQ_Disable();
+		
+		u32 i;
+		for (i = 0; i < sb->listener_count; i++)
+		{
+			if (sb->listeners[i] == listener)
+				break;
+		}
+		
+		if (i < sb->listener_count)
+			result = MIC_RESULT_INVALID_STATE;
+		else if (sb->listener_count >= MIC_SPECTRUM_LISTENERS)
+			result = MIC_RESULT_BUSY;
+		else
+		{
+			sb->listeners[sb->listener_count++] = listener;
+			result = MIC_RESULT_READY;
+		}
+		
+		IRQ_Restore(level);
+	}
+	
+	return result;
+}
+
+s32 MICSpectrumRemoveListener(s32 chan, MICSpectrumCallback listener)
+{
+	s32 result = MIC_RESULT_FATAL_ERROR;
+	
+	if (chan >= 0 && chan <= 1 &&
+		listener != NULL)
+	{
+		struct MICSpectrumBlock *sb = &__MICSpectrum[chan];
+		u32 level = IRQ_Disable();
+		
+		result = MIC_RESULT_INVALID_STATE;
+		
+		u32 i;
+		for (i = 0; i < sb->listener_count; i++)
+		{
+			if (sb->listeners[i] == listener)
+			{
+				sb->listener_count--;
+				for (; i < sb->listener_count; i++)
+					sb->listeners[i] = sb->listeners[i + 1];
+				result = MIC_RESULT_READY;
+				break;
+			}
+		}
+		
+		IRQ_Restore(level);
+	}
+	
+	return result;
+}
+
+u32 MICSpectrumLatest(s32 chan)
+{
+	if (chan >= 0 && chan <= 1)
+		return __MICSpectrum[chan].latest;
+	else
+		return 0;
+}
+
+s32 MICSpectrumRead(s32 chan, u32 seq, MICSpectrumFrame* frame)
+{
+	s32 result = MIC_RESULT_FATAL_ERROR;
+	
+	if (chan >= 0 && chan <= 1 &&
+		seq != 0 &&
+		frame != NULL)
+	{
+		struct MICSpectrumBlock *sb = &__MICSpectrum[chan];
+		const u32 latest = sb->latest;
+		
+		if ((s32)(seq - latest) > 0)
+			return MIC_RESULT_BUSY;
+		if (latest - seq >= MIC_SPECTRUM_FRAMES)
+			return MIC_RESULT_INVALID_STATE;
+		
+		volatile MICSpectrumFrame *slot = &sb->frames[seq % MIC_SPECTRUM_FRAMES];
+		if (slot->seq != seq)
+			return MIC_RESULT_INVALID_STATE;
+		
+		__MICSpectrumBarrier();
+		memcpy(frame, (const void*)slot, sizeof(MICSpectrumFrame));
+		__MICSpectrumBarrier();
+		
+		// The producer got to the slot while we were copying
+		if (slot->seq != seq)
+			return MIC_RESULT_INVALID_STATE;
+		
+		result = MIC_RESULT_READY;
+	}
+	
+	return result;
+}
@@ -0,0 +1,54 @@
+#ifndef __MICSPECTRUM_H__
+#define __MICSPECTRUM_H__
+
+#include "mic.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Short-time spectrum of a channel: a Hann-windowed, zero-padded real FFT of
+// MIC_SPECTRUM_FFT points every hop samples, published to a ring of the
+// last MIC_SPECTRUM_FRAMES frames.
+#define MIC_SPECTRUM_FFT              512
+#define MIC_SPECTRUM_BINS             (MIC_SPECTRUM_FFT / 2 + 1)
+#define MIC_SPECTRUM_FRAMES             8
+
+typedef struct _MICSpectrumFrame
+{
+	u32 seq;            // 1 for the first frame after MICSpectrumOpen
+	u32 tick;           // timebase tick the newest sample was captured at
+	u64 position;       // stream position just past the window, see MICGetPosition
+	f32 bin_hz;         // width of each bin
+	f32 power[MIC_SPECTRUM_BINS];   // |X[k]|^2, full scale sine ~ (window / 4)^2
+} MICSpectrumFrame;
+
+// Called on the analysis thread after each frame is published, with the
+// window of input it was computed from (oldest sample first).
+typedef void (*MICSpectrumCallback)(s32 chan, const MICSpectrumFrame* frame, const s16* window, u32 length);
+
+// Start computing spectra of window samples (at most MIC_SPECTRUM_FFT)
+// every hop samples on a mounted channel. Analysis runs on its own thread,
+// reading new blocks straight out of the driver ringbuffer.
+s32 MICSpectrumOpen(s32 chan, u32 window, u32 hop);
+s32 MICSpectrumClose(s32 chan);
+// Frame listeners, called in the order added; they stay across
+// MICSpectrumClose. Up to 4 per channel; MICSpectrumAddListener returns
+// MIC_RESULT_BUSY when full and MIC_RESULT_INVALID_STATE if the listener
+// is already added, MICSpectrumRemoveListener MIC_RESULT_INVALID_STATE if
+// it was not.
+s32 MICSpectrumAddListener(s32 chan, MICSpectrumCallback listener);
+s32 MICSpectrumRemoveListener(s32 chan, MICSpectrumCallback listener);
+// Sequence number of the newest frame, 0 before the first.
+u32 MICSpectrumLatest(s32 chan);
+// Copy frame seq. Any number of readers may call this concurrently with
+// the producer; none of them block it. Returns MIC_RESULT_BUSY if seq has
+// not been produced yet and MIC_RESULT_INVALID_STATE if it has already
+// been overwritten.
+s32 MICSpectrumRead(s32 chan, u32 seq, MICSpectrumFrame* frame);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,94 @@
+// Host-side decoder for MICDumpEvents output.
+//
+// Save the array filled by MICDumpEvents to a file on the console, e.g.
+//     u32 n = MICDumpEvents(events, MIC_EVENTLOG_SIZE);
+//     fwrite(events, sizeof(MICEvent), n, f);
+// then run
+//     micevents dump.bin [ticks_per_sec]
+// to print a timeline. Records are big-endian as written by the console;
+// ticks_per_sec defaults to the GameCube/Wii timebase (40.5MHz).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#define MIC_EVENT_RECORD_SIZE 8
+#define MIC_EVENT_LOCK_FAIL   5
+
+static const char *event_names[] = {
+	"?",
+	"EXI_IRQ",
+	"DMA_DONE",
+	"ALARM",
+	"TIMEOUT",
+	"LOCK_FAIL",
+	"OVERFLOW",
+	"OVERRUN",
+	"STATUS_RESET",
+	"RESUME",
+	"RECOVER",
+};
+
+static const char *event_name(unsigned type)
+{
+	if (type < sizeof(event_names) / sizeof(event_names[0]))
+		return event_names[type];
+	return event_names[0];
+}
+
+static uint32_t get32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+	{
+		fprintf(stderr, "usage: %s dump.bin [ticks_per_sec]\n", argv[0]);
+		return 1;
+	}
+	
+	double ticks_per_sec = (argc > 2) ? atof(argv[2]) : 40500000.;
+	
+	FILE *f = fopen(argv[1], "rb");
+	if (f == NULL)
+	{
+		perror(argv[1]);
+		return 1;
+	}
+	
+	unsigned char rec[MIC_EVENT_RECORD_SIZE];
+	uint32_t first = 0, last[2] = { 0, 0 };
+	int have_first = 0, have_last[2] = { 0, 0 };
+	
+	printf("%12s %10s %4s %-13s %6s\n", "time_us", "delta_us", "chan", "event", "arg");
+	
+	while (fread(rec, 1, sizeof(rec), f) == sizeof(rec))
+	{
+		uint32_t tick = get32(rec);
+		unsigned chan = rec[4] & 1;
+		unsigned type = rec[5];
+		unsigned arg = (rec[6] << 8) | rec[7];
+		
+		if (!have_first)
+		{
+			first = tick;
+			have_first = 1;
+		}
+		
+		// Ticks are 32-bit and wrap; unsigned subtraction handles a single wrap
+		double t = (uint32_t)(tick - first) * 1e6 / ticks_per_sec;
+		double d = have_last[chan] ? (uint32_t)(tick - last[chan]) * 1e6 / ticks_per_sec : 0.;
+		last[chan] = tick;
+		have_last[chan] = 1;
+		
+		printf("%12.1f %10.1f %4u %-13s %6u", t, d, chan, event_name(type), arg);
+		if (type == MIC_EVENT_LOCK_FAIL)
+			printf("  (in %s)", event_name(arg));
+		printf("\n");
+	}
+	
+	fclose(f);
+	return 0;
+}
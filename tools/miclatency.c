@@ -0,0 +1,197 @@
+// Console-side latency sweep.
+//
+// Build against libogc with the driver compiled with MIC_PROFILE, run it
+// with a mic in slot A and capture stdout (USB Gecko, or the console). Every
+// combination of sample rate, hw block size, ring size and consumer
+// strategy runs for RUN_SECONDS and prints one tab-separated row:
+//
+//   rate hw_bytes ring_bytes strategy reads p50_us p99_us max_us
+//   irq_per_sec masked_us_per_sec handler_max_us irq_disabled_max_us
+//
+// Latency is from a block's DMA completion to MICGetSamples handing out
+// its oldest sample, so it excludes the hw buffer itself (one block). p50
+// and p99 are the upper edge of the histogram bucket they fall in.
+//
+// Strategies:
+//   poll      a thread checks MICGetSamplesLeft every POLL_US
+//   wait      a thread blocks on a semaphore posted from the tx callback
+//   callback  the tx callback reads the samples itself
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <gccore.h>
+
+#include "../mic.h"
+
+#define CHAN            0
+#define RUN_SECONDS     5
+#define POLL_US         1000
+#define MAX_READ        4096
+
+enum { STRATEGY_POLL, STRATEGY_WAIT, STRATEGY_CALLBACK, STRATEGY_COUNT };
+
+static const char *strategy_names[STRATEGY_COUNT] = { "poll", "wait", "callback" };
+static const s32 rates[] = { 11025, 22050, 44100 };
+static const s32 hw_sizes[] = { 32, 64, 128 };
+static const s32 ring_sizes[] = { 2048, 8192, 32768 };
+
+static s16 samples[MAX_READ];
+static s32 read_index;
+static s32 ring_samples;
+
+static sem_t block_sem;
+
+static void consume(void)
+{
+	s32 left = MICGetSamplesLeft(CHAN, read_index);
+	if (left <= 0)
+		return;
+	if (left > MAX_READ)
+		left = MAX_READ;
+	
+	s32 end = MICGetSamples(CHAN, samples, read_index, left);
+	if (end >= 0)
+		read_index = end % ring_samples;
+}
+
+static void tx_callback_wait(s32 chan, s32 result)
+{
+	LWP_SemPost(block_sem);
+}
+
+static void tx_callback_read(s32 chan, s32 result)
+{
+	consume();
+}
+
+static void run(u32 strategy)
+{
+	u64 end = gettime() + secs_to_ticks(RUN_SECONDS);
+	
+	read_index = MICGetCurrentTop(CHAN);
+	
+	switch (strategy)
+	{
+	case STRATEGY_POLL:
+		while (gettime() < end)
+		{
+			consume();
+			usleep(POLL_US);
+		}
+		break;
+		
+	case STRATEGY_WAIT:
+		LWP_SemInit(&block_sem, 0, 1);
+		MICSetTxCallback(CHAN, tx_callback_wait);
+		while (gettime() < end)
+		{
+			LWP_SemWait(block_sem);
+			consume();
+		}
+		MICSetTxCallback(CHAN, NULL);
+		LWP_SemDestroy(block_sem);
+		break;
+		
+	case STRATEGY_CALLBACK:
+		MICSetTxCallback(CHAN, tx_callback_read);
+		while (gettime() < end)
+			usleep(100 * 1000);
+		MICSetTxCallback(CHAN, NULL);
+		break;
+	}
+}
+
+// Upper edge of the bucket holding the given fraction of reads
+static u32 percentile(const MICProfile *profile, u32 permille)
+{
+	u64 want = ((u64)profile->reads * permille + 999) / 1000;
+	u64 seen = 0;
+	u32 i;
+	
+	for (i = 0; i < MIC_LATENCY_BUCKETS; i++)
+	{
+		seen += profile->latency[i];
+		if (seen >= want)
+			return (i + 1 < MIC_LATENCY_BUCKETS) ? MICLatencyBucketLow(i + 1) : profile->latency_max;
+	}
+	
+	return profile->latency_max;
+}
+
+static void report(s32 rate, s32 hw_size, s32 ring_size, u32 strategy)
+{
+	MICProfile profile;
+	MICStats stats;
+	
+	MICGetProfile(CHAN, &profile);
+	MICGetStats(CHAN, &stats);
+	
+	const double secs = profile.elapsed / 1e6;
+	const u32 interrupts = stats.exi_interrupts + stats.dma_completions;
+	
+	printf("%d\t%d\t%d\t%s\t%u\t%u\t%u\t%u\t%.0f\t%.0f\t%u\t%u\n",
+		(int)rate, (int)hw_size, (int)ring_size, strategy_names[strategy],
+		(unsigned)profile.reads,
+		(unsigned)percentile(&profile, 500),
+		(unsigned)percentile(&profile, 990),
+		(unsigned)profile.latency_max,
+		interrupts / secs,
+		ticks_to_microsecs(profile.handler_total) / secs,
+		(unsigned)ticks_to_microsecs(profile.handler_max),
+		(unsigned)ticks_to_microsecs(stats.irq_disabled_max));
+}
+
+int main(int argc, char **argv)
+{
+	u32 r, h, g, s;
+	
+	MICInit();
+	
+	printf("rate\thw_bytes\tring_bytes\tstrategy\treads\tp50_us\tp99_us\tmax_us\t"
+		"irq_per_sec\tmasked_us_per_sec\thandler_max_us\tirq_disabled_max_us\n");
+	
+	for (g = 0; g < sizeof(ring_sizes) / sizeof(ring_sizes[0]); g++)
+	{
+		s16 *ring = memalign(32, ring_sizes[g]);
+		if (ring == NULL || MICMount(CHAN, ring, ring_sizes[g], NULL) < MIC_RESULT_READY)
+		{
+			fprintf(stderr, "mount failed for a %d byte ring\n", (int)ring_sizes[g]);
+			free(ring);
+			continue;
+		}
+		
+		s32 usable;
+		MICGetRingbuffsize(CHAN, &usable);
+		ring_samples = usable / sizeof(s16);
+		
+		for (r = 0; r < sizeof(rates) / sizeof(rates[0]); r++)
+		{
+			for (h = 0; h < sizeof(hw_sizes) / sizeof(hw_sizes[0]); h++)
+			{
+				for (s = 0; s < STRATEGY_COUNT; s++)
+				{
+					if (MICSetParams(CHAN, hw_sizes[h], rates[r], 0) < MIC_RESULT_READY ||
+						MICStart(CHAN) < MIC_RESULT_READY)
+					{
+						fprintf(stderr, "start failed at %dHz/%d bytes\n", (int)rates[r], (int)hw_sizes[h]);
+						continue;
+					}
+					
+					MICResetStats(CHAN);
+					run(s);
+					report(rates[r], hw_sizes[h], ring_sizes[g], s);
+					
+					MICStop(CHAN);
+				}
+			}
+		}
+		
+		MICUnmount(CHAN);
+		free(ring);
+	}
+	
+	return 0;
+}
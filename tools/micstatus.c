@@ -0,0 +1,232 @@
+// Status word encode/decode check.
+//
+// Links against the driver like the other tools but needs no mic, so it
+// can run anywhere they do. Every status word and every parameter a Set*
+// call accepts goes through the driver's table-driven __MICFindStatus and
+// __MICEncodeStatus, and the result is compared with the per-field
+// switches the driver used before the table. Each mismatch is printed; the
+// exit status is the number of them, capped at 255.
+
+#include <stdio.h>
+#include <gccore.h>
+
+#include "../mic.h"
+
+// Driver internals under test, from mic.c
+s32 __MICFindStatus(u32 status, s32 size, s32 rate, s32 gain);
+u32 __MICEncodeStatus(u32 status, s32 index);
+
+#define PARAM_KEEP          -1
+
+// Status bits as the reference code below knew them
+#define STATUS_GAIN15       0x0400
+#define STATUS_22050Hz      0x0800
+#define STATUS_44100Hz      0x1000
+#define STATUS_64BYTES      0x2000
+#define STATUS_128BYTES     0x4000
+#define STATUS_SIZE         (STATUS_64BYTES | STATUS_128BYTES)
+#define STATUS_RATE         (STATUS_22050Hz | STATUS_44100Hz)
+#define STATUS_PARAMS       0x7c00
+
+static const s32 sizes[] = { 32, 64, 128 };
+static const s32 rates[] = { 11025, 22050, 44100 };
+static const s32 gains[] = { 0, 15 };
+
+// Values no Set* call may accept, besides every size and gain not listed
+// above (checked exhaustively up to 1024)
+static const s32 bad_rates[] = { 0, 1, 8000, 11024, 11026, 16000, 22049, 22051,
+	32000, 44099, 44101, 48000, 88200, 96000 };
+
+#define COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+static u32 failures;
+
+static void fail(const char *what, u32 status, s32 size, s32 rate, s32 gain, u32 got, u32 want)
+{
+	if (failures++ < 50)
+		printf("%s: status %04x size %d rate %d gain %d: got %04x, want %04x\n",
+			what, (unsigned)status, (int)size, (int)rate, (int)gain, (unsigned)got, (unsigned)want);
+}
+
+
+// The reference: __MICUpdateStatus and the Set*Async calls before the table
+
+static void ref_decode(u32 status, s32 *size, s32 *rate, s32 *gain)
+{
+	switch ((status >> 13) & 3)
+	{
+	case 0:
+		*size = 32;
+		break;
+	case 1:
+		*size = 64;
+		break;
+	default:
+		*size = 128;
+		break;
+	}
+	
+	switch ((status >> 11) & 3)
+	{
+	case 0:
+		*rate = 11025;
+		break;
+	case 1:
+		*rate = 22050;
+		break;
+	default:
+		*rate = 44100;
+		break;
+	}
+	
+	*gain = (status & STATUS_GAIN15) ? 15 : 0;
+}
+
+static u32 ref_size_bits(s32 size)
+{
+	if (size == 64)
+		return STATUS_64BYTES;
+	else if (size == 128)
+		return STATUS_128BYTES;
+	return 0;
+}
+
+static u32 ref_rate_bits(s32 rate)
+{
+	if (rate == 22050)
+		return STATUS_22050Hz;
+	else if (rate == 44100)
+		return STATUS_44100Hz;
+	return 0;
+}
+
+static u32 ref_gain_bits(s32 gain)
+{
+	return (gain == 15) ? STATUS_GAIN15 : 0;
+}
+
+
+// The driver: Set*Async queue (mask, bits) and __MICSetCallback applies
+// them to the last status word
+
+static u32 apply(u32 status, u32 mask, u32 bits)
+{
+	return (status & ~mask) | (bits & mask);
+}
+
+static BOOL accepts(s32 size, s32 rate, s32 gain)
+{
+	return __MICFindStatus(0, size, rate, gain) >= 0;
+}
+
+static void check_decode(void)
+{
+	u32 status;
+	
+	for (status = 0; status < 0x10000; status++)
+	{
+		s32 size, rate, gain;
+		ref_decode(status, &size, &rate, &gain);
+		
+		// The table entry status decodes to is the first one with these
+		// fields exactly when it decodes to the same fields
+		const s32 got = __MICFindStatus(status, PARAM_KEEP, PARAM_KEEP, PARAM_KEEP);
+		const s32 want = __MICFindStatus(0, size, rate, gain);
+		if (want < 0 || got != want)
+			fail("decode", status, size, rate, gain, got, want);
+	}
+}
+
+static void check_encode(void)
+{
+	u32 status, i, j, k;
+	
+	for (status = 0; status < 0x10000; status++)
+	{
+		for (i = 0; i < COUNT(sizes); i++)
+		{
+			for (j = 0; j < COUNT(rates); j++)
+			{
+				for (k = 0; k < COUNT(gains); k++)
+				{
+					const u32 got = apply(status, STATUS_PARAMS,
+						__MICEncodeStatus(0, __MICFindStatus(0, sizes[i], rates[j], gains[k])));
+					const u32 want = (status & ~STATUS_PARAMS) |
+						ref_size_bits(sizes[i]) | ref_rate_bits(rates[j]) | ref_gain_bits(gains[k]);
+					if (got != want)
+						fail("MICSetParams", status, sizes[i], rates[j], gains[k], got, want);
+				}
+			}
+		}
+		
+		for (i = 0; i < COUNT(sizes); i++)
+		{
+			const u32 got = apply(status, STATUS_SIZE,
+				__MICEncodeStatus(0, __MICFindStatus(0, sizes[i], PARAM_KEEP, PARAM_KEEP)));
+			const u32 want = (status & ~STATUS_SIZE) | ref_size_bits(sizes[i]);
+			if (got != want)
+				fail("MICSetBuffsize", status, sizes[i], PARAM_KEEP, PARAM_KEEP, got, want);
+		}
+		
+		for (j = 0; j < COUNT(rates); j++)
+		{
+			const u32 got = apply(status, STATUS_RATE,
+				__MICEncodeStatus(0, __MICFindStatus(0, PARAM_KEEP, rates[j], PARAM_KEEP)));
+			const u32 want = (status & ~STATUS_RATE) | ref_rate_bits(rates[j]);
+			if (got != want)
+				fail("MICSetRate", status, PARAM_KEEP, rates[j], PARAM_KEEP, got, want);
+		}
+		
+		for (k = 0; k < COUNT(gains); k++)
+		{
+			const u32 got = apply(status, STATUS_GAIN15,
+				__MICEncodeStatus(0, __MICFindStatus(0, PARAM_KEEP, PARAM_KEEP, gains[k])));
+			const u32 want = (status & ~STATUS_GAIN15) | ref_gain_bits(gains[k]);
+			if (got != want)
+				fail("MICSetGain", status, PARAM_KEEP, PARAM_KEEP, gains[k], got, want);
+		}
+	}
+}
+
+static BOOL listed(const s32 *values, u32 count, s32 value)
+{
+	u32 i;
+	
+	for (i = 0; i < count; i++)
+	{
+		if (values[i] == value)
+			return TRUE;
+	}
+	
+	return FALSE;
+}
+
+static void check_rejects(void)
+{
+	s32 value;
+	u32 i;
+	
+	for (value = 0; value <= 1024; value++)
+	{
+		if (!listed(sizes, COUNT(sizes), value) && accepts(value, 11025, 0))
+			fail("size accepted", 0, value, 11025, 0, 1, 0);
+		if (!listed(gains, COUNT(gains), value) && accepts(32, 11025, value))
+			fail("gain accepted", 0, 32, 11025, value, 1, 0);
+	}
+	
+	for (i = 0; i < COUNT(bad_rates); i++)
+	{
+		if (accepts(32, bad_rates[i], 0))
+			fail("rate accepted", 0, 32, bad_rates[i], 0, 1, 0);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	check_decode();
+	check_encode();
+	check_rejects();
+	
+	printf("%u mismatches\n", (unsigned)failures);
+	return (failures > 255) ? 255 : (int)failures;
+}